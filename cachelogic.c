@@ -1,4 +1,5 @@
 #include "tips.h"
+#include "util.h"
 
 /* The following two functions are defined in util.c */
 
@@ -71,8 +72,47 @@ const int BYTES_IN_WORD = 4;
 const int BITS_IN_BYTE = 8;
 const int BITS_IN_WORD = BYTES_IN_WORD * BITS_IN_BYTE;
 
-// returns the transferunit mode for accessDRAM()
-TransferUnit getTransferUnit();
+// counters for accesses simulated in detail
+CacheStats cache_stats;
+SetCounters set_stats[MAX_SETS];
+
+// state of the SMARTS-style sampler, see configure_sampling()
+SamplingState sampling;
+
+// state of the set sampler, see configure_set_sampling()
+SetSamplingState set_sampling = { 1 };
+
+// how accesses are simulated, see set_simulation_mode()
+SimulationMode simulation_mode = DETAILED;
+
+// counters of the coherence directory, see configure_directory()
+DirectoryStats directory;
+
+// the caches that hold a block, as the directory knows them
+typedef struct {
+    unsigned int block;
+    unsigned long long sharers;
+    int overflow;
+} DirectoryEntry;
+
+// histograms of the reuse distance profiler, see configure_reuse_profile()
+ReuseProfile reuse_profile;
+
+// totals of the false sharing detector, see configure_sharing_profile()
+SharingProfile sharing_profile;
+
+// way masks of the tenants sharing the cache, see configure_partitions()
+PartitionState partitions = { PARTITION_OFF };
+
+// the cores keep private caches that have to be kept coherent
+#define PRIVATE_CACHES() (multicore.cores > 1 && partitions.mode == PARTITION_OFF)
+
+// the block replaced by the most recent miss, filled in by handleMiss()
+static struct {
+    int valid;
+    int dirty;
+    unsigned int tag;
+} eviction;
 
 // converts a word into an array of bytes and puts into the byte array that is passed
 void wordToByteArray(word data, byte * bytes);
@@ -106,8 +146,8 @@ cacheSet * getCacheSet(address);
 // returns the cache block associated with this address
 cacheBlock * getCacheBlock(address, cacheSet *);
 
-// returns the word in this block that the address is saved in or null for miss
-word * getWord(address, cacheBlock *);
+// returns the word in this block that the address is saved in
+word getWord(address, cacheBlock *);
 
 // handles cache misses by pulling a block from memory and adding it to the cache
 int handleMiss(address);
@@ -118,14 +158,57 @@ cacheBlock * getWriteableBlock(cacheSet *);
 // commits block to memory at given address
 int writeBlockToMemory(address, cacheBlock *);
 
+// calculates the address where this block is supposed to be saved
+address getBlockAddress(unsigned int block_index, cacheBlock * block);
+
 // calculates the address where this block is supposed to be saved and saves it there
 int saveBlock(unsigned int block_index, cacheBlock * block);
 
-// performs a read on this address and returns the word that was found
-word * cacheRead(address);
+// performs a read on this address, stores the word found in data and returns HIT or MISS
+CacheAction cacheRead(address, word *);
+
+// performs a write on this address and returns HIT or MISS
+CacheAction cacheWrite(address, word *);
 
-// performs a write on this address
-void cacheWrite(address, word *);
+// records the outcome of a detailed access in cache_stats and the sampler
+void recordAccess(address, WriteEnable, CacheAction);
+
+// advances the sampler by one access and returns 1 if the access is simulated in detail
+int sampleDetailed();
+
+// moves a word between the CPU and memory without touching the cache or logging
+void bypassCache(address, word *, WriteEnable);
+
+// makes the other cores' caches coherent with an access of the running core,
+// as a snooping MESI protocol would, and returns 1 if its block ends up shared
+int snoopCaches(address, WriteEnable);
+
+// records whether the block now holding this address is shared, unless the
+// fill failed and the access went to memory instead
+void markShared(address, int);
+
+// returns the directory entry of the block holding this address, adding it if needed
+DirectoryEntry * getDirectoryEntry(address);
+
+// removes the running core from the sharers of a block it no longer holds
+void dropSharer(address);
+
+// adds the reuse distances of this access to reuse_profile
+void profileReuse(address);
+
+// counts the hit of this access in the shadow tags of the running core and
+// repartitions the cache at the end of every UCP interval
+void monitorUtility(address);
+
+// tracks the words the running core uses in the block of this data access
+// and counts the copies its writes take from the other cores
+void detectSharing(address, WriteEnable);
+
+// returns the counters of the instruction at pc, adding them if needed
+PcCounters * getPcCounters(address);
+
+// counts one more eviction of victim by tag in set
+void countEviction(unsigned int set, unsigned int tag, unsigned int victim);
 
 // sanity check, runs unit tests on helper functions
 void runTests();
@@ -179,6 +262,27 @@ void accessMemory(address addr, word *data, WriteEnable we)
 
     /* Declare variables here */
 
+    /* fast-forwarding: no model sees the access, memory is kept exact */
+    if(simulation_mode == FUNCTIONAL) {
+        unsigned int bytes;
+        byte * memory = mapDRAM(addr, &bytes);
+
+        if(memory != NULL && bytes >= sizeof(word)) {
+            if(we == WRITE) memcpy(memory, data, sizeof(word));
+            else memcpy(data, memory, sizeof(word));
+        } else bypassCache(addr, data, we);
+        return;
+    }
+
+    /* fetches down a squashed path only leave their blocks in the cache, and
+       without a cache they have nothing to do */
+    if(!wrong_path_access) {
+        access_tlb(addr);
+        if(reuse_profile.enabled) profileReuse(addr);
+        if(sharing_profile.enabled && access_type == DATA) detectSharing(addr, we);
+    } else if(assoc == 0) return;
+    tick_dram(1);
+
     /* handle the case of no cache at all - leave this in */
     if (assoc == 0)
     {
@@ -214,45 +318,62 @@ void accessMemory(address addr, word *data, WriteEnable we)
   */
 
     /* Start adding code here */
+    CacheAction action;
+
+    /* set sampling: accesses to sets that are not simulated go straight to memory */
+    if(set_sampling.ratio > 1) {
+        if(!wrong_path_access) set_sampling.accesses++;
+
+        if(!set_sampling.check && !is_sampled_set(getIndex(addr))) {
+            if(!wrong_path_access) bypassCache(addr, data, we);
+            return;
+        }
+    }
+
+    /* coherence: the other cores' caches see the access on the bus first */
+    int shared = PRIVATE_CACHES() ? snoopCaches(addr, we) : 0;
+
+    if(partitions.mode == PARTITION_UCP && !wrong_path_access) monitorUtility(addr);
+
+    /* functional warming and wrong-path fetches: keep tags, data and
+       replacement state exact, but skip accounting, highlighting and DRAM
+       logging */
+    if(simulation_mode == WARMING || wrong_path_access || (sampling.enabled && !sampleDetailed())) {
+        LogLevel level = log_level;
+
+        if(log_level > LOG_INSTRUCTIONS) log_level = LOG_INSTRUCTIONS;
+        if(we == WRITE) cacheWrite(addr, data);
+        else cacheRead(addr, data);
+        log_level = level;
+        if(PRIVATE_CACHES()) markShared(addr, shared);
+        return;
+    }
+
     if(we == WRITE) {
 
-        cacheWrite(addr, data);
+        action = cacheWrite(addr, data);
         
     } else {
 
-        *data = *cacheRead(addr);
+        action = cacheRead(addr, data);
 
     }
 
-    /* This call to accessDRAM occurs when you modify any of the
-     cache parameters. It is provided as a stop gap solution.
-     At some point, ONCE YOU HAVE MORE OF YOUR CACHELOGIC IN PLACE,
-     THIS LINE SHOULD BE REMOVED.
-  */
-    // accessDRAM(addr, (byte *)data, WORD_SIZE, we);
-}
+    if(PRIVATE_CACHES()) markShared(addr, shared);
 
-// returns the transferunit mode for accessDRAM()
-TransferUnit getTransferUnit() {
-    TransferUnit transferUnit;
-    int words_in_block = block_size / BYTES_IN_WORD;
+    recordAccess(addr, we, action);
 
-    switch(words_in_block) {
-        case 2:
-            transferUnit = DOUBLEWORD_SIZE;
-        break;
-        case 3:
-            transferUnit = QUADWORD_SIZE;
-        break;
-        case 4:
-            transferUnit = QUADWORD_SIZE;
-        break;
-        case 5:
-            transferUnit = OCTWORD_SIZE;
-        break;
-    }
+    if(IS_GUI_ACTIVE() || trace_active) {
+        cacheSet * set = getCacheSet(addr);
+        cacheBlock * block = getCacheBlock(addr, set);
+        int way = block == NULL ? 0 : block - set->block;
 
-    return transferUnit;
+        if(trace_active)
+            trace_event(EVENT_CACHE, addr, we, BYTES_IN_WORD, action, getIndex(addr), way, 0);
+
+        if(IS_GUI_ACTIVE() && block != NULL)
+            highlight_offset(getIndex(addr), way, getOffsetInBytes(addr), action);
+    }
 }
 
 // converts a word into an array of bytes
@@ -322,7 +443,7 @@ int getTagBits() {
 
 // calculates and returns the offset from this address in number of words
 int getOffsetInWords(address addrss) {
-    int offset = addrss % (block_size / BYTES_IN_WORD);
+    int offset = (addrss / BYTES_IN_WORD) % (block_size / BYTES_IN_WORD);
     return offset;
 }
 
@@ -333,13 +454,12 @@ int getOffsetInBytes(address addrss) {
 
 // calculates and returns the index from this address
 int getIndex(address addrss) {
-    int temp = (int) addrss / block_size;
-    return temp % set_count;
+    return (addrss / block_size) % set_count;
 }
 
 // calculates and returns the tag from this address
 int getTag(address addrss) {
-    return addrss >> (getOffsetBits() + getIndexBits());
+    return addrss >> (getOffsetBits() + uint_log2(BYTES_IN_WORD) + getIndexBits());
 }
 
 // returns the cache set associated with this address
@@ -353,42 +473,68 @@ cacheBlock * getCacheBlock(address addrss, cacheSet * set) {
     int tag = getTag(addrss);
 
     for(int index = 0; index < assoc; index++ )
-        if(set->block[index].tag == tag) return &(set->block[index]);
+        if(set->block[index].valid == VALID && set->block[index].tag == tag)
+            return &(set->block[index]);
 
     return NULL;
 }
 
-// TODO: call free on malloc called here
-// returns the word in this block that the address is saved in or null for miss
-word * getWord(address addrss, cacheBlock * block) {
-    int offset = getOffsetInWords(addrss);
-    word * data = malloc(sizeof(word));
-    *data = byteArrayToWord(block->data, offset);
-    return data;
+int peekMemory(address addr, word * data) {
+    unsigned int bytes;
+    byte * memory;
+
+    if(assoc != 0) {
+        cacheBlock * block = getCacheBlock(addr, getCacheSet(addr));
+
+        if(block != NULL) {
+            *data = getWord(addr, block);
+            return 0;
+        }
+    }
+
+    if((memory = mapDRAM(addr & ~3, &bytes)) == NULL)
+        return -1;
+    memcpy(data, memory, sizeof(word));
+    return 0;
+}
+
+// returns the word in this block that the address is saved in
+word getWord(address addrss, cacheBlock * block) {
+    return byteArrayToWord(block->data, getOffsetInWords(addrss));
 }
 
 // handles cache misses by pulling a block from memory and adding it to the cache
 int handleMiss(address addrss) {
     cacheSet * set = getCacheSet(addrss);
     cacheBlock * block = getWriteableBlock(set);
-    TransferUnit transferUnit = getTransferUnit();
+
+    eviction.valid = block->valid == VALID;
+    eviction.dirty = eviction.valid && block->dirty == DIRTY;
+    eviction.tag = block->tag;
+
+    // replacement hint: the directory stops counting on this cache
+    if(eviction.valid && directory.enabled && PRIVATE_CACHES())
+        dropSharer(getBlockAddress(getIndex(addrss), block));
 
     // calculate address and save block to memory
-    if(block->valid == VALID && block->dirty == DIRTY) {
+    if(eviction.dirty) {
 
         unsigned int index = getIndex(addrss);
         int writeStatus = saveBlock(index, block);
 
-        if(writeStatus != 0) {
+        if(writeStatus != 1) {
             printf("handleMiss() failed to persist block being replaced. \n");
             return -1;
         }
 
     }
 
-    int status = accessDRAM(addrss, block->data, transferUnit, READ);
+    // fill the whole block, starting from its first byte
+    address block_adrs = addrss - (addrss % block_size);
+    int status = burstDRAM(block_adrs, block->data, block_size, READ);
     if(status == 0) {
 
+        block->valid = VALID;
         block->dirty = VIRGIN;
         block->lru.value = 0;
         block->tag = getTag(addrss);
@@ -400,30 +546,39 @@ int handleMiss(address addrss) {
 }
 
 // returns a block that we can write data to, find block using LRU or random cache replacement, if no empty block was found in the cache set
+// under partitioning only the ways of the running core's mask are candidates
 cacheBlock * getWriteableBlock(cacheSet * set) {
-    int lru_block = 0;
+    unsigned int ways = (1u << assoc) - 1;
+    int lru_block = -1;
+    int allowed = 0;
+
+    if(partitions.mode != PARTITION_OFF && (partitions.masks[multicore.current] & ways) != 0)
+        ways &= partitions.masks[multicore.current];
 
     // look for an empty block
     for(int index = 0; index < assoc; index++) {
 
+        if(!(ways & (1u << index))) continue;
+        allowed++;
+
         if(set->block[index].valid == INVALID) 
             return &(set->block[index]);
 
-        if(set->block[index].lru.value < set->block[lru_block].lru.value)
+        if(lru_block < 0 || set->block[index].lru.value < set->block[lru_block].lru.value)
             lru_block = index;
     }
 
     if(policy == LRU) return &(set->block[lru_block]);
     
-    int random = randomint(assoc);
-    return &(set->block[random]);
+    int random = randomint(allowed);
+    for(int index = 0; ; index++)
+        if((ways & (1u << index)) && random-- == 0)
+            return &(set->block[index]);
 }
 
 // commits block to memory at given address
 int writeBlockToMemory(address addrss, cacheBlock * block) {
-    TransferUnit transferUnit = getTransferUnit();
-
-    int status = accessDRAM(addrss, block->data, transferUnit, WRITE);
+    int status = burstDRAM(addrss, block->data, block_size, WRITE);
 
     if(status == 0) {
         block->dirty = VIRGIN;
@@ -433,64 +588,66 @@ int writeBlockToMemory(address addrss, cacheBlock * block) {
     return -1;
 }
 
+// calculates the address where this block is supposed to be saved
+address getBlockAddress(unsigned int block_index, cacheBlock * block) {
+    int offset_bits = getOffsetBits() + uint_log2(BYTES_IN_WORD);
+    address old_adrs = block_index << offset_bits;
+    old_adrs += block->tag << (getIndexBits() + offset_bits);
+    return old_adrs;
+}
+
 // calculates the address where this block is supposed to be saved and saves it there
 int saveBlock(unsigned int block_index, cacheBlock * block) {
-    unsigned int index = block_index;
-    unsigned int tag = block->tag;
-    unsigned int offset = 0;
-    address old_adrs = offset;
-    old_adrs += index << getOffsetBits();
-    old_adrs += tag << (getIndexBits() + getOffsetBits());
-    return writeBlockToMemory(old_adrs, block);
+    return writeBlockToMemory(getBlockAddress(block_index, block), block);
 }
 
-// performs a read on this address and returns the word that was found
-word * cacheRead(address addrss) {
+// performs a read on this address, stores the word found in data and returns HIT or MISS
+CacheAction cacheRead(address addrss, word * data) {
     cacheSet * set = getCacheSet(addrss);
     cacheBlock * block = getCacheBlock(addrss, set);
+    CacheAction action = HIT;
 
     if(block == NULL) {
 
+        action = MISS;
         if(handleMiss(addrss) != 1) {
             
             printf("cacheRead(), failed to persist block being replaced\n");
-            return NULL;
+            accessDRAM(addrss, (byte *)data, WORD_SIZE, READ);
+            return action;
     
         }
 
+        block = getCacheBlock(addrss, set);
     }
 
-    block = getCacheBlock(addrss, set);
-    word * data = getWord(addrss, block);
+    *data = getWord(addrss, block);
 
     block->lru.value += 1;
-    block->valid = VALID;
 
-    return data;
+    return action;
 }
 
-// performs a write on this address
-void cacheWrite(address addrss, word * word) {
+// performs a write on this address and returns HIT or MISS
+CacheAction cacheWrite(address addrss, word * word) {
     cacheSet * set = getCacheSet(addrss);
     cacheBlock * block = getCacheBlock(addrss, set);
     int offset = getOffsetInBytes(addrss);
+    CacheAction action = HIT;
 
-    // addrss is not in the cache, add it
+    // addrss is not in the cache, allocate on write by bringing the block in
     if(block == NULL) {
 
-        cacheBlock * block = getWriteableBlock(set);
+        action = MISS;
+        if(handleMiss(addrss) != 1) {
 
-        // we need to replace this block, but it should be saved first
-        if(block->valid == VALID && block->dirty == DIRTY) {
-            int status = saveBlock(getIndex(addrss), block);
+            printf("cacheWrite(), failed to persist block being replaced\n");
+            accessDRAM(addrss, (byte *)word, WORD_SIZE, WRITE);
+            return action;
 
-            if(status != 1) {
-                printf("cacheWrite(), failed to persist block being replaced\n");
-                return;
-            }
         }
 
-        block->tag = getTag(addrss);
+        block = getCacheBlock(addrss, set);
     }
 
     byte bytes[BYTES_IN_WORD];
@@ -499,10 +656,10 @@ void cacheWrite(address addrss, word * word) {
     for(int index = 0; index < BYTES_IN_WORD; index++)
         block->data[offset + index] = bytes[index];
     
-    // write through, persist the cache changes to main memory
+    // write through, persist only the written word to main memory
     if(memory_sync_policy == WRITE_THROUGH) {
 
-        writeBlockToMemory(addrss, block);
+        accessDRAM(addrss, bytes, WORD_SIZE, WRITE);
 
     } else {
 
@@ -511,7 +668,1073 @@ void cacheWrite(address addrss, word * word) {
     }
 
     block->lru.value += 1;
-    block->valid = VALID;
+
+    return action;
+}
+
+// records the outcome of a detailed access in cache_stats and the sampler
+void recordAccess(address addrss, WriteEnable we, CacheAction action) {
+    cache_stats.accesses++;
+
+    if(we == WRITE) cache_stats.writes++;
+    else cache_stats.reads++;
+
+    SetCounters * counters = &(set_stats[getIndex(addrss)]);
+
+    if(action == HIT) {
+
+        cache_stats.hits++;
+        counters->hits++;
+        multicore.hits[multicore.current]++;
+
+    } else {
+
+        cache_stats.misses++;
+        counters->misses++;
+        multicore.misses[multicore.current]++;
+
+        if(eviction.valid) {
+            counters->evictions++;
+            countEviction(getIndex(addrss), getTag(addrss), eviction.tag);
+        }
+
+        if(eviction.dirty) {
+            cache_stats.writebacks++;
+            counters->dirty_evictions++;
+        }
+
+    }
+
+    if(access_type == DATA) {
+        PcCounters * pc_counters = getPcCounters(access_pc);
+
+        pc_counters->accesses++;
+        if(action == MISS) pc_counters->misses++;
+        if(action == MISS && eviction.dirty) pc_counters->writebacks++;
+    }
+
+    if(!sampling.enabled || !sampling.measuring) return;
+
+    sampling.window_accesses++;
+    if(action == MISS) sampling.window_misses++;
+
+    // the last access of a period closes the measurement window
+    if(sampling.position == 0) {
+        double rate = (double) sampling.window_misses / sampling.window_accesses;
+
+        sampling.units++;
+        sampling.sum += rate;
+        sampling.sum_squares += rate * rate;
+        sampling.window_accesses = 0;
+        sampling.window_misses = 0;
+    }
+}
+
+// advances the sampler by one access and returns 1 if the access is simulated in detail
+int sampleDetailed() {
+    unsigned int position = sampling.position;
+    unsigned int measure_start = sampling.period - sampling.window;
+
+    if(++sampling.position == sampling.period) sampling.position = 0;
+
+    if(position < measure_start - sampling.warmup) {
+        sampling.warmed++;
+        return 0;
+    }
+
+    sampling.detailed++;
+    sampling.measuring = position >= measure_start;
+    return 1;
+}
+
+// mixes the bits of a set index, so that sets picked by the hash are spread
+// independently of the power-of-two strides programs tend to walk with
+static unsigned int hashSetIndex(unsigned int index) {
+    index = (index ^ (index >> 16)) * 0x45d9f3bu;
+    index = (index ^ (index >> 16)) * 0x45d9f3bu;
+    return index ^ (index >> 16);
+}
+
+/*
+  Returns 1 if the set at index is one of the simulated ones: the
+  set_count / ratio sets, rounded up, whose index hashes lowest. The choice
+  only depends on the set count and the ratio, so it is computed once for
+  both.
+ */
+int is_sampled_set(unsigned int index) {
+    static unsigned int sampled = 0;
+    static int sampled_count = -1;
+    static unsigned int sampled_ratio = 0;
+
+    if(sampled_count != set_count || sampled_ratio != set_sampling.ratio) {
+        unsigned int sets = (set_count + set_sampling.ratio - 1) / set_sampling.ratio;
+
+        sampled = 0;
+        for(int set = 0; set < set_count; set++) {
+            unsigned int lower = 0;
+
+            for(int other = 0; other < set_count; other++)
+                if(hashSetIndex(other) < hashSetIndex(set) || (hashSetIndex(other) == hashSetIndex(set) && other < set))
+                    lower++;
+            if(lower < sets) sampled |= 1u << set;
+        }
+
+        sampled_count = set_count;
+        sampled_ratio = set_sampling.ratio;
+    }
+
+    return (sampled >> index) & 1;
+}
+
+// moves a word between the CPU and memory without touching the cache or logging
+void bypassCache(address addrss, word * data, WriteEnable we) {
+    LogLevel level = log_level;
+
+    if(log_level > LOG_INSTRUCTIONS) log_level = LOG_INSTRUCTIONS;
+    accessDRAM(addrss, (byte *)data, WORD_SIZE, we);
+    log_level = level;
+}
+
+void markShared(address addrss, int shared) {
+    cacheBlock * block = getCacheBlock(addrss, getCacheSet(addrss));
+
+    if(block != NULL) block->shared = shared;
+}
+
+int snoopCaches(address addrss, WriteEnable we) {
+    cacheBlock * own = getCacheBlock(addrss, getCacheSet(addrss));
+    unsigned long long others = ~(1ull << multicore.current);
+    DirectoryEntry * entry = NULL;
+    unsigned int fanout = 0;
+    int shared = 0;
+
+    // read hits and writes to a modified or exclusive block stay off the bus
+    if(own != NULL && (we == READ || !own->shared))
+        return own->shared;
+
+    // a write to a shared block only has to invalidate the other copies
+    if(own != NULL) multicore.upgrades++;
+
+    // squashed fetches keep the caches coherent but stay out of the counters
+    int counted = !wrong_path_access;
+
+    // with a directory only the caches it names see the request, or every
+    // cache for an invalidation once its pointers have overflowed
+    if(directory.enabled) {
+        entry = getDirectoryEntry(addrss);
+        directory.requests += counted;
+        if(we == READ || !entry->overflow)
+            others &= entry->sharers;
+        else
+            directory.broadcasts++;
+    }
+
+    for(unsigned int core = 0; core < multicore.cores; core++) {
+        if(!(others & (1ull << core))) continue;
+        if(we == WRITE) fanout++;
+
+        cacheBlock * block = getCacheBlock(addrss, &(core_caches[core][getIndex(addrss)]));
+        if(block == NULL) continue;
+
+        // the only copy answers the request itself, a third hop
+        if(entry != NULL && (block->dirty == DIRTY || !block->shared))
+            directory.three_hop += counted;
+
+        // a modified copy is written back so that memory can serve the miss
+        if(block->dirty == DIRTY) {
+            burstDRAM(getBlockAddress(getIndex(addrss), block), block->data, block_size, WRITE);
+            block->dirty = VIRGIN;
+            multicore.interventions += counted;
+        }
+
+        if(we == WRITE) {
+            block->valid = INVALID;
+            multicore.invalidations++;
+        } else {
+            block->shared = 1;
+            shared = 1;
+        }
+    }
+
+    if(entry != NULL) {
+        if(entry->sharers == 0) {
+            if(++directory.entries > directory.peak_entries)
+                directory.peak_entries = directory.entries;
+        }
+
+        if(we == WRITE) {
+            entry->sharers = 1ull << multicore.current;
+            entry->overflow = 0;
+            if(fanout != 0) directory.invalidating++;
+            directory.invalidations_sent += fanout;
+            if(fanout > directory.max_fanout) directory.max_fanout = fanout;
+        } else {
+            entry->sharers |= 1ull << multicore.current;
+            if(directory.pointers != 0 && count_bits(entry->sharers) > directory.pointers)
+                entry->overflow = 1;
+        }
+    }
+
+    return shared;
+}
+
+// coherence directory, open addressing keyed by block number plus one so
+// that 0 marks an empty slot; entries stay once added
+static DirectoryEntry * directory_table;
+static unsigned int directory_table_size;
+static unsigned int directory_table_count;
+
+// returns the slot of block in table, or the empty slot it would go in
+static DirectoryEntry * lookupDirectory(DirectoryEntry * table, unsigned int size, unsigned int block) {
+    unsigned int slot = (block * 2654435761u) & (size - 1);
+
+    while(table[slot].block != 0 && table[slot].block != block)
+        slot = (slot + 1) & (size - 1);
+
+    return &(table[slot]);
+}
+
+DirectoryEntry * getDirectoryEntry(address addrss) {
+    unsigned int block = addrss / block_size + 1;
+    DirectoryEntry * entry;
+
+    if(directory_table_count * 2 >= directory_table_size) {
+        DirectoryEntry * old_table = directory_table;
+        unsigned int old_size = directory_table_size;
+
+        directory_table_size = old_size == 0 ? 1024 : old_size * 2;
+        directory_table = calloc(directory_table_size, sizeof(DirectoryEntry));
+
+        for(unsigned int slot = 0; slot < old_size; slot++)
+            if(old_table[slot].block != 0)
+                *lookupDirectory(directory_table, directory_table_size, old_table[slot].block) = old_table[slot];
+
+        free(old_table);
+    }
+
+    entry = lookupDirectory(directory_table, directory_table_size, block);
+    if(entry->block == 0) {
+        entry->block = block;
+        directory_table_count++;
+    }
+
+    return entry;
+}
+
+void dropSharer(address addrss) {
+    DirectoryEntry * entry;
+
+    if(directory_table == NULL) return;
+
+    entry = lookupDirectory(directory_table, directory_table_size, addrss / block_size + 1);
+    if(entry->sharers == 0) return;
+
+    entry->sharers &= ~(1ull << multicore.current);
+    if(entry->sharers == 0) {
+        entry->overflow = 0;
+        directory.entries--;
+    }
+}
+
+// forgets every sharer, for when every cache has been emptied
+void clear_directory() {
+    free(directory_table);
+    directory_table = NULL;
+    directory_table_size = 0;
+    directory_table_count = 0;
+    directory.entries = 0;
+}
+
+/*
+  Switches coherence between snooping and a directory whose entries name up
+  to pointers sharers, or every core with a full bit vector if pointers is
+  0. The caches are drained first so that the directory starts empty.
+
+  returns 0 if successful, -1 if there are more pointers than cores
+ */
+int configure_directory(int enabled, unsigned int pointers) {
+    if(pointers > MAX_CORES)
+        return -1;
+
+    drain_cache();
+    memset(&directory, 0, sizeof(directory));
+    directory.enabled = enabled;
+    directory.pointers = pointers;
+
+    return 0;
+}
+
+// writes every dirty block of every core back to memory and invalidates the
+// whole cache
+void drain_cache() {
+    address addrs[MAX_CORES * MAX_SETS * MAX_ASSOC];
+    byte * data[MAX_CORES * MAX_SETS * MAX_ASSOC];
+    unsigned int lines = 0;
+
+    // write every dirty block back as one batch
+    for(unsigned int core = 0; core < multicore.cores; core++) {
+        for(int index = 0; index < set_count; index++) {
+            for(int way = 0; way < assoc; way++) {
+                cacheBlock * block = &(core_caches[core][index].block[way]);
+
+                if(block->valid == VALID && block->dirty == DIRTY) {
+                    addrs[lines] = getBlockAddress(index, block);
+                    data[lines++] = block->data;
+                    block->dirty = VIRGIN;
+                }
+
+                block->valid = INVALID;
+            }
+        }
+    }
+
+    burstDRAMLines(addrs, data, lines, block_size, WRITE);
+    clear_directory();
+}
+
+/*
+  Utility-based cache partitioning
+  ================================
+  Each tenant has shadow tags for every set, kept in true LRU order over all
+  ways as if it had the cache to itself. A shadow hit at stack position p
+  means the tenant would have hit with p + 1 ways, so utility[t][p] counts
+  the hits each extra way buys. At the end of every interval the lookahead
+  algorithm hands out the ways beyond one per tenant to whoever gains the
+  most hits per way, and the counters are halved to age them.
+*/
+static int shadow_tags[MAX_CORES][MAX_SETS][MAX_ASSOC];   // MRU first, -1 empty
+static unsigned int utility_accesses;
+
+// gives every tenant contiguous ways in proportion to its utility
+static void repartition() {
+    unsigned int tenants = multicore.cores;
+    unsigned int ways[MAX_CORES];
+    unsigned int balance;
+    unsigned int first = 0;
+    int moved = 0;
+
+    if(tenants > (unsigned int)assoc) return;
+
+    for(unsigned int tenant = 0; tenant < tenants; tenant++)
+        ways[tenant] = 1;
+
+    for(balance = assoc - tenants; balance > 0; ) {
+        double best_utility = -1;
+        unsigned int best_tenant = 0;
+        unsigned int best_ways = 1;
+
+        for(unsigned int tenant = 0; tenant < tenants; tenant++) {
+            unsigned long long hits = 0;
+
+            for(unsigned int extra = 1; extra <= balance; extra++) {
+                hits += partitions.utility[tenant][ways[tenant] + extra - 1];
+                if((double)hits / extra > best_utility) {
+                    best_utility = (double)hits / extra;
+                    best_tenant = tenant;
+                    best_ways = extra;
+                }
+            }
+        }
+
+        ways[best_tenant] += best_ways;
+        balance -= best_ways;
+    }
+
+    for(unsigned int tenant = 0; tenant < tenants; tenant++) {
+        unsigned int mask = ((1u << ways[tenant]) - 1) << first;
+
+        if(partitions.masks[tenant] != mask) moved = 1;
+        partitions.masks[tenant] = mask;
+        first += ways[tenant];
+
+        for(int position = 0; position < assoc; position++)
+            partitions.utility[tenant][position] /= 2;
+    }
+
+    partitions.repartitions += moved;
+}
+
+void monitorUtility(address addrss) {
+    int * stack = shadow_tags[multicore.current][getIndex(addrss)];
+    int tag = getTag(addrss);
+    int position = 0;
+
+    while(position < assoc - 1 && stack[position] != tag)
+        position++;
+
+    if(stack[position] == tag)
+        partitions.utility[multicore.current][position]++;
+
+    // the tag moves to the MRU position, pushing the ones above it down
+    for(; position > 0; position--)
+        stack[position] = stack[position - 1];
+    stack[0] = tag;
+
+    if(++utility_accesses == partitions.interval) {
+        utility_accesses = 0;
+        repartition();
+    }
+}
+
+/*
+  Makes the cores share core 0's cache as tenants that may each only fill
+  the ways of their mask on a miss. PARTITION_STATIC takes one mask per
+  core from masks, a core whose mask holds none of the ways may fill any.
+  PARTITION_UCP starts from equal partitions and resizes them every
+  interval accesses. PARTITION_OFF gives each core its private cache back.
+  The caches are drained first since the sharing changes.
+
+  returns 0 if successful, -1 if UCP has more tenants than ways or no interval
+ */
+int configure_partitions(PartitionMode mode, const unsigned int * masks, unsigned int interval) {
+    if(mode == PARTITION_UCP && (multicore.cores > (unsigned int)assoc || interval == 0))
+        return -1;
+
+    drain_cache();
+    memset(&partitions, 0, sizeof(partitions));
+    memset(shadow_tags, 0xff, sizeof(shadow_tags));
+    utility_accesses = 0;
+    partitions.mode = mode;
+    partitions.interval = interval;
+
+    if(mode == PARTITION_STATIC)
+        memcpy(partitions.masks, masks, sizeof(partitions.masks));
+
+    // UCP starts from equal shares, the first tenants taking any spare way
+    for(unsigned int tenant = 0, first = 0; mode == PARTITION_UCP && tenant < multicore.cores; tenant++) {
+        unsigned int ways = assoc / multicore.cores + (tenant < assoc % multicore.cores);
+
+        partitions.masks[tenant] = ((1u << ways) - 1) << first;
+        first += ways;
+    }
+
+    cache = core_caches[mode == PARTITION_OFF ? multicore.current : 0];
+    return 0;
+}
+
+/*
+  Simulates only one in ratio sets of the cache, picked by a hash of their
+  index, see is_sampled_set(). Accesses to the other sets bypass the
+  cache, and the sampled counters are scaled back up to estimate the full
+  cache. With check set no set is bypassed, so cache_stats holds the real
+  counts to measure the estimate against. A ratio of 1 simulates every
+  set. The cache is drained first so that bypassed accesses never see
+  stale memory.
+
+  returns 0 if successful, -1 if the ratio would leave no set to simulate,
+  -2 if the pipeline is being timed, see configure_pipeline()
+ */
+int configure_set_sampling(unsigned int ratio, int check) {
+    if(ratio == 0 || (set_count != 0 && ratio > set_count))
+        return -1;
+    if(ratio > 1 && pipeline.enabled)
+        return -2;
+
+    drain_cache();
+    set_sampling.ratio = ratio;
+    set_sampling.check = ratio > 1 && check;
+    reset_cache_stats();
+
+    return 0;
+}
+
+// per-PC counters of loads and stores, open addressing keyed by pc
+static PcCounters * pc_table;
+static unsigned int pc_table_size;
+static unsigned int pc_table_count;
+
+// returns the slot of pc in table, or the empty slot it would go in
+static PcCounters * lookupPc(PcCounters * table, unsigned int size, address pc) {
+    // instructions are word aligned, so the low bits carry no information
+    unsigned int slot = ((pc >> 2) * 2654435761u) & (size - 1);
+
+    while(table[slot].accesses != 0 && table[slot].pc != pc)
+        slot = (slot + 1) & (size - 1);
+
+    return &(table[slot]);
+}
+
+// returns the counters of the instruction at pc, adding them if needed
+PcCounters * getPcCounters(address pc) {
+    PcCounters * counters;
+
+    if(pc_table_count * 2 >= pc_table_size) {
+        PcCounters * old_table = pc_table;
+        unsigned int old_size = pc_table_size;
+
+        pc_table_size = old_size == 0 ? 256 : old_size * 2;
+        pc_table = calloc(pc_table_size, sizeof(PcCounters));
+
+        for(unsigned int slot = 0; slot < old_size; slot++)
+            if(old_table[slot].accesses != 0)
+                *lookupPc(pc_table, pc_table_size, old_table[slot].pc) = old_table[slot];
+
+        free(old_table);
+    }
+
+    counters = lookupPc(pc_table, pc_table_size, pc);
+    if(counters->accesses == 0) {
+        counters->pc = pc;
+        pc_table_count++;
+    }
+
+    return counters;
+}
+
+static int compareMisses(const void * a, const void * b) {
+    const PcCounters * left = a;
+    const PcCounters * right = b;
+
+    if(left->misses != right->misses) return left->misses < right->misses ? 1 : -1;
+    if(left->accesses != right->accesses) return left->accesses < right->accesses ? 1 : -1;
+    return (left->pc > right->pc) - (left->pc < right->pc);
+}
+
+/*
+  Copies the counters of the count instructions with the most misses into
+  hot, most misses first.
+
+  returns the number of instructions copied
+ */
+int get_hot_pcs(PcCounters * hot, int count) {
+    PcCounters * all = malloc((pc_table_count + 1) * sizeof(PcCounters));
+    int found = 0;
+
+    for(unsigned int slot = 0; slot < pc_table_size; slot++)
+        if(pc_table[slot].accesses != 0)
+            all[found++] = pc_table[slot];
+
+    qsort(all, found, sizeof(PcCounters), compareMisses);
+
+    if(found > count) found = count;
+    memcpy(hot, all, found * sizeof(PcCounters));
+    free(all);
+
+    return found;
+}
+
+// which tag evicted which in each set, open addressing keyed by all three
+static EvictionPair * eviction_table;
+static unsigned int eviction_table_size;
+static unsigned int eviction_table_count;
+
+// returns the slot of the pair in table, or the empty slot it would go in
+static EvictionPair * lookupEviction(EvictionPair * table, unsigned int size, unsigned int set, unsigned int tag, unsigned int victim) {
+    unsigned int slot = ((set * 31 + tag) * 2654435761u ^ victim * 40503u) & (size - 1);
+
+    while(table[slot].count != 0 &&
+          (table[slot].set != set || table[slot].tag != tag || table[slot].victim != victim))
+        slot = (slot + 1) & (size - 1);
+
+    return &(table[slot]);
+}
+
+// counts one more eviction of victim by tag in set
+void countEviction(unsigned int set, unsigned int tag, unsigned int victim) {
+    EvictionPair * pair;
+
+    if(eviction_table_count * 2 >= eviction_table_size) {
+        EvictionPair * old_table = eviction_table;
+        unsigned int old_size = eviction_table_size;
+
+        eviction_table_size = old_size == 0 ? 256 : old_size * 2;
+        eviction_table = calloc(eviction_table_size, sizeof(EvictionPair));
+
+        for(unsigned int slot = 0; slot < old_size; slot++) {
+            EvictionPair * old_pair = &(old_table[slot]);
+
+            if(old_pair->count != 0)
+                *lookupEviction(eviction_table, eviction_table_size, old_pair->set, old_pair->tag, old_pair->victim) = *old_pair;
+        }
+
+        free(old_table);
+    }
+
+    pair = lookupEviction(eviction_table, eviction_table_size, set, tag, victim);
+    if(pair->count == 0) {
+        pair->set = set;
+        pair->tag = tag;
+        pair->victim = victim;
+        eviction_table_count++;
+    }
+
+    pair->count++;
+}
+
+static int compareEvictions(const void * a, const void * b) {
+    const EvictionPair * left = a;
+    const EvictionPair * right = b;
+
+    if(left->count != right->count) return left->count < right->count ? 1 : -1;
+    if(left->set != right->set) return left->set < right->set ? -1 : 1;
+    if(left->tag != right->tag) return left->tag < right->tag ? -1 : 1;
+    return (left->victim > right->victim) - (left->victim < right->victim);
+}
+
+// returns the number of distinct (set, tag, victim) evictions recorded
+int count_eviction_pairs() {
+    return eviction_table_count;
+}
+
+/*
+  Copies the count most frequent (set, tag, victim) evictions into pairs,
+  most frequent first.
+
+  returns the number of pairs copied
+ */
+int get_eviction_pairs(EvictionPair * pairs, int count) {
+    EvictionPair * all = malloc((eviction_table_count + 1) * sizeof(EvictionPair));
+    int found = 0;
+
+    for(unsigned int slot = 0; slot < eviction_table_size; slot++)
+        if(eviction_table[slot].count != 0)
+            all[found++] = eviction_table[slot];
+
+    qsort(all, found, sizeof(EvictionPair), compareEvictions);
+
+    if(found > count) found = count;
+    memcpy(pairs, all, found * sizeof(EvictionPair));
+    free(all);
+
+    return found;
+}
+
+/*
+  Reuse distance profiler
+  =======================
+  Every block remembers the position of its last access on a timeline. A
+  Fenwick tree over the timeline holds a 1 at the last access of each block,
+  so the unique blocks touched since a block's previous access is a range sum
+  over the tree, O(log n) per access. When the timeline fills up, the live
+  positions are renumbered in order, and the tree only grows if more than
+  half of it is live.
+*/
+#define REUSE_EMPTY 0xffffffff
+
+typedef struct {
+    unsigned int block;
+    unsigned int position;            // slot on the Fenwick timeline
+    unsigned long long time;          // access number, for time distance
+} ReuseEntry;
+
+static ReuseEntry * reuse_table;      // open addressing, keyed by block
+static unsigned int reuse_table_size;
+static unsigned int reuse_blocks;
+static int * reuse_tree;              // Fenwick tree, 1-based
+static unsigned int reuse_tree_size;
+static unsigned int reuse_position;
+static unsigned long long reuse_time;
+
+// adds delta at timeline slot position
+static void reuseTreeAdd(unsigned int position, int delta) {
+    for(position++; position <= reuse_tree_size; position += position & -position)
+        reuse_tree[position] += delta;
+}
+
+// returns the number of live slots in [0, position)
+static unsigned int reuseTreeSum(unsigned int position) {
+    unsigned int sum = 0;
+
+    for(; position > 0; position -= position & -position)
+        sum += reuse_tree[position];
+
+    return sum;
+}
+
+// returns the histogram bucket of a distance
+static int reuseBucket(unsigned long long distance) {
+    if(distance == 0) return 0;
+    if(distance >> 32) return REUSE_BUCKETS - 1;
+    return uint_log2(distance) + 1;
+}
+
+// returns the table entry of block, or the empty entry it would go in
+static ReuseEntry * reuseLookup(unsigned int block) {
+    unsigned int slot = (block * 2654435761u) & (reuse_table_size - 1);
+
+    while(reuse_table[slot].block != REUSE_EMPTY && reuse_table[slot].block != block)
+        slot = (slot + 1) & (reuse_table_size - 1);
+
+    return &(reuse_table[slot]);
+}
+
+// doubles the block table
+static void reuseGrowTable() {
+    ReuseEntry * old_table = reuse_table;
+    unsigned int old_size = reuse_table_size;
+
+    reuse_table_size *= 2;
+    reuse_table = malloc(reuse_table_size * sizeof(ReuseEntry));
+    for(unsigned int slot = 0; slot < reuse_table_size; slot++)
+        reuse_table[slot].block = REUSE_EMPTY;
+
+    for(unsigned int slot = 0; slot < old_size; slot++)
+        if(old_table[slot].block != REUSE_EMPTY)
+            *reuseLookup(old_table[slot].block) = old_table[slot];
+
+    free(old_table);
+}
+
+static int compareReusePositions(const void * a, const void * b) {
+    unsigned int left = (*(ReuseEntry * const *)a)->position;
+    unsigned int right = (*(ReuseEntry * const *)b)->position;
+
+    return (left > right) - (left < right);
+}
+
+// renumbers the live timeline slots from 0, growing the tree if it is over half full
+static void reuseCompact() {
+    ReuseEntry ** live = malloc(reuse_blocks * sizeof(ReuseEntry *));
+    unsigned int count = 0;
+
+    for(unsigned int slot = 0; slot < reuse_table_size; slot++)
+        if(reuse_table[slot].block != REUSE_EMPTY)
+            live[count++] = &(reuse_table[slot]);
+
+    qsort(live, count, sizeof(ReuseEntry *), compareReusePositions);
+
+    if(count * 2 > reuse_tree_size) {
+        reuse_tree_size *= 2;
+        free(reuse_tree);
+        reuse_tree = malloc((reuse_tree_size + 1) * sizeof(int));
+    }
+
+    memset(reuse_tree, 0, (reuse_tree_size + 1) * sizeof(int));
+    for(unsigned int index = 0; index < count; index++) {
+        live[index]->position = index;
+        reuseTreeAdd(index, 1);
+    }
+
+    reuse_position = count;
+    free(live);
+}
+
+// adds the reuse distances of this access to reuse_profile
+void profileReuse(address addrss) {
+    unsigned int block = addrss / reuse_profile.block_bytes;
+    ReuseEntry * entry = reuseLookup(block);
+    int type = access_type;
+
+    if(reuse_position == reuse_tree_size) {
+        reuseCompact();
+        entry = reuseLookup(block);
+    }
+
+    reuse_profile.accesses[type]++;
+
+    if(entry->block == REUSE_EMPTY) {
+
+        reuse_profile.cold[type]++;
+        entry->block = block;
+        reuse_blocks++;
+
+    } else {
+
+        unsigned int stack_distance = reuseTreeSum(reuse_position) - reuseTreeSum(entry->position + 1);
+        unsigned long long time_distance = reuse_time - entry->time - 1;
+
+        reuse_profile.stack_histogram[type][reuseBucket(stack_distance)]++;
+        reuse_profile.time_histogram[type][reuseBucket(time_distance)]++;
+        reuseTreeAdd(entry->position, -1);
+
+    }
+
+    entry->position = reuse_position++;
+    entry->time = reuse_time++;
+    reuseTreeAdd(entry->position, 1);
+
+    if(reuse_blocks * 2 > reuse_table_size) reuseGrowTable();
+}
+
+/*
+  Starts profiling reuse distances at a granularity of block_bytes, which is
+  rounded down to a power of two of at least a word. Any earlier profile is
+  discarded. A block_bytes of 0 turns profiling off.
+
+  returns 0
+ */
+int configure_reuse_profile(unsigned int block_bytes) {
+    free(reuse_table);
+    free(reuse_tree);
+    reuse_table = NULL;
+    reuse_tree = NULL;
+    memset(&reuse_profile, 0, sizeof(reuse_profile));
+
+    if(block_bytes == 0) return 0;
+
+    reuse_profile.enabled = 1;
+    reuse_profile.block_bytes = 1 << uint_log2(block_bytes);
+    if(reuse_profile.block_bytes < BYTES_IN_WORD)
+        reuse_profile.block_bytes = BYTES_IN_WORD;
+
+    reuse_table_size = 1 << 12;
+    reuse_table = malloc(reuse_table_size * sizeof(ReuseEntry));
+    for(unsigned int slot = 0; slot < reuse_table_size; slot++)
+        reuse_table[slot].block = REUSE_EMPTY;
+
+    reuse_tree_size = 1 << 16;
+    reuse_tree = calloc(reuse_tree_size + 1, sizeof(int));
+
+    reuse_blocks = 0;
+    reuse_position = 0;
+    reuse_time = 0;
+
+    return 0;
+}
+
+/*
+  False sharing detector
+  ======================
+  Follows the copies each core would hold of every block at block_bytes
+  granularity, independently of the cache configuration. A read gives the
+  core a copy and marks the word as used by it, a write takes the copy of
+  every other core. An invalidation counts as true sharing if the invalidated
+  core had used the written word since it got its copy, and as false sharing
+  if it had only used other words of the block.
+*/
+typedef struct {
+    SharedBlock info;                 // info.addr is the key
+    int used;
+    unsigned long long holders;       // cores with a copy of the block
+    unsigned long long * touched;     // per word, holders that used it
+    unsigned long long * writers;     // per word, cores that ever wrote it
+} SharingEntry;
+
+static SharingEntry * sharing_table;  // open addressing, keyed by block
+static unsigned int sharing_table_size;
+
+// returns the table entry of the block at addrss, or the empty entry it would go in
+static SharingEntry * sharingLookup(SharingEntry * table, unsigned int size, address addrss) {
+    unsigned int slot = (addrss / sharing_profile.block_bytes * 2654435761u) & (size - 1);
+
+    while(table[slot].used && table[slot].info.addr != addrss)
+        slot = (slot + 1) & (size - 1);
+
+    return &(table[slot]);
+}
+
+// returns the table entry of the block at addrss, adding it if needed
+static SharingEntry * getSharingEntry(address addrss) {
+    unsigned int words = sharing_profile.block_bytes / BYTES_IN_WORD;
+    SharingEntry * entry;
+
+    if(sharing_profile.blocks * 2 >= sharing_table_size) {
+        SharingEntry * old_table = sharing_table;
+        unsigned int old_size = sharing_table_size;
+
+        sharing_table_size = old_size * 2;
+        sharing_table = calloc(sharing_table_size, sizeof(SharingEntry));
+
+        for(unsigned int slot = 0; slot < old_size; slot++)
+            if(old_table[slot].used)
+                *sharingLookup(sharing_table, sharing_table_size, old_table[slot].info.addr) = old_table[slot];
+
+        free(old_table);
+    }
+
+    entry = sharingLookup(sharing_table, sharing_table_size, addrss);
+    if(!entry->used) {
+        entry->used = 1;
+        entry->info.addr = addrss;
+        entry->touched = calloc(2 * words, sizeof(unsigned long long));
+        entry->writers = entry->touched + words;
+        sharing_profile.blocks++;
+    }
+
+    return entry;
+}
+
+// tracks the words the running core uses in the block of this data access
+// and counts the copies its writes take from the other cores
+void detectSharing(address addrss, WriteEnable we) {
+    address block = addrss & ~(address)(sharing_profile.block_bytes - 1);
+    unsigned int offset = (addrss - block) / BYTES_IN_WORD;
+    unsigned long long core = 1ull << multicore.current;
+    SharingEntry * entry = getSharingEntry(block);
+
+    if(we == WRITE) {
+        unsigned long long victims = entry->holders & ~core;
+
+        if(victims != 0) {
+            unsigned int true_count = count_bits(victims & entry->touched[offset]);
+            unsigned int false_count = count_bits(victims) - true_count;
+            unsigned int words = sharing_profile.block_bytes / BYTES_IN_WORD;
+            int pc;
+
+            entry->info.true_invalidations += true_count;
+            entry->info.false_invalidations += false_count;
+            sharing_profile.true_invalidations += true_count;
+            sharing_profile.false_invalidations += false_count;
+
+            for(pc = 0; pc < MAX_SHARING_PCS; pc++)
+                if(entry->info.pc_invalidations[pc] == 0 || entry->info.pcs[pc] == access_pc)
+                    break;
+            if(pc < MAX_SHARING_PCS) {
+                entry->info.pcs[pc] = access_pc;
+                entry->info.pc_invalidations[pc] += true_count + false_count;
+            }
+
+            // the invalidated cores start over with their next copy
+            entry->holders &= ~victims;
+            for(unsigned int word_index = 0; word_index < words; word_index++)
+                entry->touched[word_index] &= ~victims;
+        }
+
+        entry->writers[offset] |= core;
+    }
+
+    entry->holders |= core;
+    entry->touched[offset] |= core;
+}
+
+static int compareSharedBlocks(const void * a, const void * b) {
+    const SharedBlock * left = a;
+    const SharedBlock * right = b;
+    unsigned long long left_count = left->true_invalidations + left->false_invalidations;
+    unsigned long long right_count = right->true_invalidations + right->false_invalidations;
+
+    if(left_count != right_count) return left_count < right_count ? 1 : -1;
+    return (left->addr > right->addr) - (left->addr < right->addr);
+}
+
+/*
+  Copies the count blocks whose writes caused the most invalidations into
+  blocks, most invalidations first, with their writer word counts filled in.
+
+  returns the number of blocks copied
+ */
+int get_shared_blocks(SharedBlock * blocks, int count) {
+    SharedBlock * all = malloc((sharing_profile.blocks + 1) * sizeof(SharedBlock));
+    unsigned int words = sharing_profile.block_bytes / BYTES_IN_WORD;
+    int found = 0;
+
+    for(unsigned int slot = 0; slot < sharing_table_size; slot++) {
+        SharingEntry * entry = &(sharing_table[slot]);
+
+        if(!entry->used || entry->info.true_invalidations + entry->info.false_invalidations == 0)
+            continue;
+
+        all[found] = entry->info;
+        for(unsigned int word_index = 0; word_index < words; word_index++) {
+            all[found].writers |= entry->writers[word_index];
+            if(count_bits(entry->writers[word_index]) > 1)
+                all[found].shared_words++;
+            else if(entry->writers[word_index] != 0)
+                all[found].private_words++;
+        }
+        found++;
+    }
+
+    qsort(all, found, sizeof(SharedBlock), compareSharedBlocks);
+
+    if(found > count) found = count;
+    memcpy(blocks, all, found * sizeof(SharedBlock));
+    free(all);
+
+    return found;
+}
+
+/*
+  Starts detecting false sharing at a granularity of block_bytes, which is
+  rounded down to a power of two of at least a word. Any earlier results are
+  discarded. A block_bytes of 0 turns detection off.
+
+  returns 0, or -1 if block_bytes is over MAX_SHARING_BLOCK
+ */
+int configure_sharing_profile(unsigned int block_bytes) {
+    if(block_bytes > MAX_SHARING_BLOCK) return -1;
+
+    for(unsigned int slot = 0; slot < sharing_table_size; slot++)
+        if(sharing_table[slot].used)
+            free(sharing_table[slot].touched);
+    free(sharing_table);
+    sharing_table = NULL;
+    sharing_table_size = 0;
+    memset(&sharing_profile, 0, sizeof(sharing_profile));
+
+    if(block_bytes == 0) return 0;
+
+    sharing_profile.enabled = 1;
+    sharing_profile.block_bytes = 1 << uint_log2(block_bytes);
+    if(sharing_profile.block_bytes < BYTES_IN_WORD)
+        sharing_profile.block_bytes = BYTES_IN_WORD;
+
+    sharing_table_size = 256;
+    sharing_table = calloc(sharing_table_size, sizeof(SharingEntry));
+
+    return 0;
+}
+
+// clears the detailed access counters
+void reset_cache_stats() {
+    unsigned int ratio = set_sampling.ratio;
+    int check = set_sampling.check;
+
+    memset(&cache_stats, 0, sizeof(cache_stats));
+    memset(set_stats, 0, sizeof(set_stats));
+    memset(&set_sampling, 0, sizeof(set_sampling));
+    set_sampling.ratio = ratio;
+    set_sampling.check = check;
+
+    free(eviction_table);
+    eviction_table = NULL;
+    eviction_table_size = 0;
+    eviction_table_count = 0;
+
+    free(pc_table);
+    pc_table = NULL;
+    pc_table_size = 0;
+    pc_table_count = 0;
+
+    reset_tlb_stats();
+    reset_dram_stats();
+    reset_pipeline_stats();
+    reset_predictor_stats();
+    reset_multicore_stats();
+
+    directory.requests = 0;
+    directory.three_hop = 0;
+    directory.invalidating = 0;
+    directory.invalidations_sent = 0;
+    directory.max_fanout = 0;
+    directory.broadcasts = 0;
+    directory.peak_entries = directory.entries;
+}
+
+/*
+  Switches how accessMemory() simulates accesses. Entering FUNCTIONAL drains
+  the cache first, since bypassed accesses would otherwise see stale memory,
+  so fast-forwarding always leaves a cold cache behind it.
+ */
+void set_simulation_mode(SimulationMode mode) {
+    if(mode == FUNCTIONAL && simulation_mode != FUNCTIONAL)
+        drain_cache();
+
+    simulation_mode = mode;
+}
+
+/*
+  Turns on SMARTS-style sampling of the access stream. Every period accesses,
+  the first (period - warmup - window) are handled by functional warming, the
+  next warmup are simulated in detail without being measured and the last
+  window are measured. A period of 0 turns sampling off.
+
+  returns 0 if successful, -1 if the parameters do not fit in a period, -2
+  if the pipeline is being timed, see configure_pipeline()
+ */
+int configure_sampling(unsigned int period, unsigned int warmup, unsigned int window) {
+    if(period != 0 && (window == 0 || warmup + window > period))
+        return -1;
+    if(period != 0 && pipeline.enabled)
+        return -2;
+
+    memset(&sampling, 0, sizeof(sampling));
+    sampling.enabled = period != 0;
+    sampling.period = period;
+    sampling.warmup = warmup;
+    sampling.window = window;
+
+    return 0;
 }
 
 // sanity check, runs unit tests on helper functions
@@ -687,7 +1910,7 @@ void testHandleMiss() {
     int passed_tests = 0;
 
     address ad = 88;
-    int expected_tag = 11;
+    int expected_tag = 2;
     int expected_lru = 0;
     word expected_word = 88;
     byte expected_bytes[BYTES_IN_WORD];
@@ -714,7 +1937,7 @@ void testHandleMiss() {
         tag = block->tag;
         lru_value = block->lru.value;
         byte = &(block->data[getOffsetInBytes(ad)]);
-        word_value = *(getWord(ad, block));
+        word_value = getWord(ad, block);
     }
 
     passed_tests += assertTrue(1, success, "handleMiss() should return True i.e 1 if succesful");
@@ -756,28 +1979,28 @@ void runCacheTests() {
     printf("Running cache function tests \n");
 
     address ad = 180;
-    int offset = 0;
+    int offset = 1;
     int index = 2;
     int block_id = 0;
-    int tag = 22;
+    int tag = 5;
 
     cacheSet * expected_set = &(cache[index]);
     cacheBlock * expected_block = &(expected_set->block[block_id]);
-    expected_block->tag = tag; // we need to fool the test into thinking the data is in the cache
-    expected_block->data[offset] = ad;
-    byte * expected_data = &(expected_block->data[offset]);
+    expected_block->valid = VALID; // we need to fool the test into thinking the data is in the cache
+    expected_block->tag = tag;
+    insertWordIntoBlock(expected_block, ad, offset);
 
     // setup cache params, 2 words per block, 4 sets, 3-way assoc.
     setCacheParams(2, 4, 3);
     
     cacheSet * set = getCacheSet(ad);
     cacheBlock * block = getCacheBlock(ad, set);
-    word * data = getWord(ad, block);
+    word data = getWord(ad, block);
 
     int passed_tests = 0;
     passed_tests += assertTrue((int)expected_set, (int)set, "testing getCacheSet()..");
     passed_tests += assertTrue((int)expected_block, (int)block, "testing getCacheBlock()..");
-    passed_tests += assertTrue(*expected_data, *data, "testing getWord()..");
+    passed_tests += assertTrue(ad, data, "testing getWord()..");
 
     printf("Passed %d/3 tests.\n", passed_tests);
 
@@ -794,9 +2017,9 @@ void runBaseTests() {
     int expected_offsetbits = 1;
     int expected_indexbits = 2;
 
-    int expected_offset = 0;
+    int expected_offset = 4;
     int expected_index = 2;
-    int expected_tag = 22;
+    int expected_tag = 5;
 
     // setup cache params, 2 words per block, 4 sets, 3-way assoc.
     setCacheParams(2, 4, 3);
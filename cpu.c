@@ -1,22 +1,27 @@
 #include "tips.h"
+#include "util.h"
 #include <netinet/in.h>
 
 word registers[32];
 word hilo[2];
 address PC;
+address entry_point = PROGRAM_START;
+AccessType access_type;
+address access_pc;
+int wrong_path_access;
 
 /******************************************************************************
    Nice Macros to simplify typing
  *****************************************************************************/
 
-#define rs (registers[getRs(inst)])
-#define rt (registers[getRt(inst)])
-#define rd (registers[getRd(inst)])
-#define jtarget ( (PC & 0xf0000000) | (getTarget(inst) << 2) )
-#define btarget (PC + (getSImmed(inst) << 2))
 #define hi (hilo[0])
 #define lo (hilo[1])
 
+/* whether fetching an instruction has any effect besides returning it */
+#define FETCH_OBSERVED() (simulation_mode != FUNCTIONAL && \
+                          (assoc != 0 || reuse_profile.enabled || tlb_stats.entries != 0 || \
+                           dram_stats.enabled || trace_active || LOG_ENABLED(LOG_DRAM)))
+
 unsigned int getOpcode(const word instr){
   return instr >> 26;
 }
@@ -53,9 +58,12 @@ unsigned int getTarget(const word instr){
   return instr & 0x03ffffff;
 }
 
-void disassemble_inst(word inst)
+/*
+  Writes the assembly of inst into buffer. Branch and jump targets are
+  computed relative to pc, the address of the instruction after inst.
+ */
+void format_inst(char* buffer, word inst, address pc)
 {
-  char buffer[200];
   switch(getOpcode(inst))
   {
   case 0: /* R-type */
@@ -142,16 +150,16 @@ void disassemble_inst(word inst)
     }
     break;
   case 2: /* j     */
-    sprintf(buffer, "j\t\t0x%.8X\n", (unsigned int)((PC & 0xf0000000) | getTarget(inst) << 2));
+    sprintf(buffer, "j\t\t0x%.8X\n", (unsigned int)((pc & 0xf0000000) | getTarget(inst) << 2));
     break;
   case 3: /* jal   */
-    sprintf(buffer, "jal\t0x%.8X\n", (unsigned int)((PC & 0xf0000000) | getTarget(inst) << 2));
+    sprintf(buffer, "jal\t0x%.8X\n", (unsigned int)((pc & 0xf0000000) | getTarget(inst) << 2));
     break;
   case 4: /* beq   */
-    sprintf(buffer, "beq\t$%u, $%u, 0x%.8X\n", getRs(inst), getRt(inst), (unsigned int)((getSImmed(inst) << 2) + PC));
+    sprintf(buffer, "beq\t$%u, $%u, 0x%.8X\n", getRs(inst), getRt(inst), (unsigned int)((getSImmed(inst) << 2) + pc));
     break;
   case 5: /* bne   */
-    sprintf(buffer, "bne\t$%u, $%u, 0x%.8X\n", getRs(inst), getRt(inst), (unsigned int)((getSImmed(inst) << 2) + PC));
+    sprintf(buffer, "bne\t$%u, $%u, 0x%.8X\n", getRs(inst), getRt(inst), (unsigned int)((getSImmed(inst) << 2) + pc));
     break;
   case 8: /* addi  */
     sprintf(buffer, "addi\t$%u, $%u, %d\n", getRt(inst), getRs(inst), getSImmed(inst));
@@ -195,13 +203,495 @@ void disassemble_inst(word inst)
   default:
     sprintf(buffer, "Unsupported instruction\n");
   }
+}
 
+void disassemble_inst(word inst)
+{
+  char buffer[200];
+
+  format_inst(buffer, inst, PC);
   append_log(buffer);
 }
 
-void execute_inst(word inst)
+/******************************************************************************
+   Predecoded instructions
+ *****************************************************************************/
+
+/*
+  Every operation once, as name and body. The body runs with d pointing at
+  the DecodedInst being executed and PC already past it; it is expanded
+  into a handler function for single steps and into a label for threaded
+  dispatch in run_processor(). Operations from jr on end a basic block.
+  CODE_WRITTEN() lets threaded dispatch leave a block that a store rewrote;
+  single steps have nothing to leave.
+ */
+#define R(field) (registers[d->field])
+#define CODE_WRITTEN(addr)
+
+static int sentinel_reached;
+
+#define OPERATIONS(X) \
+  X(nop,  ) \
+  X(sll,  R(rd) = R(rt) << d->shamt) \
+  X(srl,  R(rd) = R(rt) >> d->shamt) \
+  X(srav, R(rd) = (int)(R(rt)) >> R(rs)) \
+  X(sllv, R(rd) = R(rt) << R(rs)) \
+  X(srlv, R(rd) = R(rt) >> R(rs)) \
+  X(mfhi, R(rd) = hi) \
+  X(mflo, R(rd) = lo) \
+  X(mthi, hi = R(rs)) \
+  X(mtlo, lo = R(rs)) \
+  X(mult, lo = R(rs) * R(rt)) \
+  X(div,  lo = R(rs) / R(rt); hi = R(rs) % R(rt)) \
+  X(add,  R(rd) = R(rs) + R(rt)) \
+  X(sub,  R(rd) = R(rs) - R(rt)) \
+  X(and,  R(rd) = R(rs) & R(rt)) \
+  X(or,   R(rd) = R(rs) | R(rt)) \
+  X(xor,  R(rd) = R(rs) ^ R(rt)) \
+  X(slt,  R(rd) = (R(rs) & 0x80000000) ^ (R(rt) & 0x80000000) ? R(rs) >> 31 : R(rs) < R(rt)) \
+  X(addi, R(rt) = R(rs) + d->imm) \
+  X(slti, R(rt) = (R(rs) & 0x80000000) ^ (d->imm & 0x80000000) ? R(rs) >> 31 : R(rs) < d->imm) \
+  X(andi, R(rt) = R(rs) & d->imm) \
+  X(ori,  R(rt) = R(rs) | d->imm) \
+  X(lui,  R(rt) = d->imm) \
+  X(lw,   access_type = DATA; access_pc = d->pc; \
+          accessMemory(R(rs) + d->imm, &R(rt), READ)) \
+  X(sw,   address addr = R(rs) + d->imm; \
+          access_type = DATA; access_pc = d->pc; \
+          accessMemory(addr, &R(rt), WRITE); \
+          invalidate_decoded(addr); \
+          CODE_WRITTEN(addr)) \
+  X(jr,   PC = R(rs)) \
+  X(jalr, R(rd) = PC; PC = R(rs)) \
+  X(j,    PC = d->target) \
+  X(jal,  registers[31] = PC; PC = d->target) \
+  X(beq,  if(R(rs) == R(rt)) PC = d->target) \
+  X(bne,  if(R(rs) != R(rt)) PC = d->target) \
+  X(done, stop_run(); sentinel_reached = 1)
+
+#define OP_KIND(name, ...) OP_##name,
+typedef enum { OPERATIONS(OP_KIND) OP_end } OpKind;
+
+#define ENDS_BLOCK(kind) ((kind) >= OP_jr)
+
+/* An instruction decoded once, ready to run: its operation and operands,
+   with immediates already extended and branch and jump targets already
+   computed from pc. label is filled in when it is part of a block. */
+typedef struct DecodedInst {
+  const void* label;
+  address pc;
+  word inst;
+  word imm;
+  address target;
+  byte kind;
+  byte rs;
+  byte rt;
+  byte rd;
+  byte shamt;
+} DecodedInst;
+
+#define OP_HANDLER(name, ...) static void op_##name(const DecodedInst* d) { __VA_ARGS__; }
+OPERATIONS(OP_HANDLER)
+
+#define OP_HANDLER_ENTRY(name, ...) op_##name,
+static void (* const handlers[])(const DecodedInst* d) = { OPERATIONS(OP_HANDLER_ENTRY) };
+
+/* An unaligned PC no instruction can have, marking empty table entries */
+#define NO_PC 1
+
+/* Pipeline timing model, see PipelineStats in tips.h. Each instruction is
+   charged one cycle plus its stalls as execute_step() runs it. */
+PipelineStats pipeline = { 0, 1, 100, 2 };
+
+/* Destination of the instruction just timed if it was a load, else 0 */
+static byte load_target;
+
+/* Cycles the cache and TLB models have charged to accesses so far */
+#define MEMORY_CYCLES() (cache_stats.accesses * (pipeline.hit_latency - 1) + \
+                         (cache_stats.misses + cache_stats.writebacks) * pipeline.miss_penalty + \
+                         tlb_stats.walk_cycles)
+
+/* whether instructions are timed, fast-forwarding and warming are not */
+#define TIMING() (pipeline.enabled && simulation_mode == DETAILED)
+
+/* Cycles of an access with no cache to satisfy it */
+#define UNCACHED_CYCLES() (assoc == 0 ? pipeline.miss_penalty : 0)
+
+/*
+  Turns on the pipeline timing model and clears its counters. Stalls come
+  from the detailed cache counters, which accesses warmed or bypassed by a
+  sampler never reach, so timing and sampling exclude each other.
+
+  returns 0 if successful, -1 if hits would take no time at all, -2 if
+  access or set sampling is on
+ */
+int configure_pipeline(unsigned int hit_latency, unsigned int miss_penalty, unsigned int branch_penalty)
 {
-  char buffer[200];
+  if(hit_latency == 0)
+    return -1;
+  if(sampling.enabled || set_sampling.ratio > 1)
+    return -2;
+
+  pipeline.enabled = 1;
+  pipeline.hit_latency = hit_latency;
+  pipeline.miss_penalty = miss_penalty;
+  pipeline.branch_penalty = branch_penalty;
+  reset_pipeline_stats();
+  return 0;
+}
+
+void reset_pipeline_stats()
+{
+  pipeline.instructions = 0;
+  pipeline.cycles = 0;
+  pipeline.load_use = 0;
+  pipeline.branch = 0;
+  pipeline.fetch = 0;
+  pipeline.data = 0;
+  load_target = 0;
+}
+
+/* returns 1 if d reads reg in ID or EX, where a load right ahead of it can
+   only forward after one bubble. The data of a store is needed in MEM. */
+static int reads_early(const DecodedInst* d, byte reg)
+{
+  switch(d->kind)
+  {
+  case OP_nop:
+  case OP_mfhi:
+  case OP_mflo:
+  case OP_lui:
+  case OP_j:
+  case OP_jal:
+  case OP_done:
+    return 0;
+  case OP_sll:
+  case OP_srl:
+    return d->rt == reg;
+  case OP_mthi:
+  case OP_mtlo:
+  case OP_addi:
+  case OP_slti:
+  case OP_andi:
+  case OP_ori:
+  case OP_lw:
+  case OP_sw:
+  case OP_jr:
+  case OP_jalr:
+    return d->rs == reg;
+  default:
+    return d->rs == reg || d->rt == reg;
+  }
+}
+
+/* returns the cycles a taken branch or jump of d loses with no predictor:
+   fetch goes on past it until ID for j and jal, until EX for the others */
+static unsigned int static_redirect(const DecodedInst* d)
+{
+  if(d->kind == OP_j || d->kind == OP_jal)
+    return 1;
+  if(d->kind == OP_jr || d->kind == OP_jalr || PC != d->pc + sizeof(instruction))
+    return pipeline.branch_penalty;
+  return 0;
+}
+
+/* charges d, which has just run, with its cycle, the cycles lost
+   redirecting fetch after it and its stalls */
+static void time_instruction(const DecodedInst* d, unsigned int branch, unsigned long long fetch_stall, unsigned long long data_stall)
+{
+  unsigned long long load_use = 0;
+
+  /* The first instruction also waits for the pipeline to fill */
+  if(pipeline.instructions == 0)
+    pipeline.cycles += 4;
+
+  if(load_target != 0 && reads_early(d, load_target))
+    load_use = 1;
+  load_target = (d->kind == OP_lw ? d->rt : 0);
+
+  pipeline.instructions++;
+  pipeline.cycles += 1 + load_use + branch + fetch_stall + data_stall;
+  pipeline.load_use += load_use;
+  pipeline.branch += branch;
+  pipeline.fetch += fetch_stall;
+  pipeline.data += data_stall;
+}
+
+/* Branch prediction unit, see PredictorStats in tips.h */
+PredictorStats predictor = { 0, BIMODAL, 4096, 256, 0 };
+
+static byte pattern_table[MAX_PREDICTOR_ENTRIES];
+static unsigned int global_history;
+
+static struct {
+  address pc;
+  address target;
+} btb[MAX_BTB_ENTRIES];
+
+/* whether control transfers are predicted, fast-forwarding skips it */
+#define PREDICTING() (predictor.enabled && simulation_mode != FUNCTIONAL)
+
+/*
+  Turns on branch prediction with an empty BTB and every counter weakly
+  not taken, and clears its counters.
+
+  returns 0 if successful, -1 if a table size is not a supported power of 2
+ */
+int configure_predictor(PredictorKind kind, unsigned int entries, unsigned int btb_entries, unsigned int wrong_path)
+{
+  unsigned int i;
+
+  if(entries == 0 || entries > MAX_PREDICTOR_ENTRIES || entries != (1u << uint_log2(entries)))
+    return -1;
+  if(btb_entries == 0 || btb_entries > MAX_BTB_ENTRIES || btb_entries != (1u << uint_log2(btb_entries)))
+    return -1;
+
+  memset(pattern_table, 1, sizeof(pattern_table));
+  for(i = 0; i < MAX_BTB_ENTRIES; i++)
+    btb[i].pc = NO_PC;
+  global_history = 0;
+
+  predictor.enabled = 1;
+  predictor.kind = kind;
+  predictor.entries = entries;
+  predictor.btb_entries = btb_entries;
+  predictor.wrong_path = wrong_path;
+  reset_predictor_stats();
+  return 0;
+}
+
+void reset_predictor_stats()
+{
+  predictor.branches = 0;
+  predictor.mispredicted = 0;
+  predictor.redirects = 0;
+  predictor.btb_misses = 0;
+  predictor.wrong_path_fetches = 0;
+}
+
+/* fetches count instructions from pc on into the I-cache, as a pipeline
+   does down a path it is about to squash; the fetches change what the
+   cache holds, and the DRAM traffic of their fills and of the writebacks
+   coherence forces is modeled, but of the access, coherence, sampling,
+   profiling and TLB counters only predictor.wrong_path_fetches sees them */
+static void fetch_wrong_path(address pc, unsigned int count)
+{
+  word inst;
+
+  access_type = FETCH;
+  wrong_path_access = 1;
+  for(; count > 0; count--)
+  {
+    access_pc = pc;
+    accessMemory(pc, &inst, READ);
+    predictor.wrong_path_fetches++;
+    pc += sizeof(instruction);
+  }
+  wrong_path_access = 0;
+}
+
+/*
+  Predicts the branch or jump d has just run as it was fetched, then trains
+  the predictor with where it went. Fetch follows the BTB target when the
+  direction is predicted taken and falls through otherwise.
+
+  returns the cycles lost redirecting fetch if it went the wrong way: until
+  EX for a wrong direction or a register jump, until ID for the target of
+  any other taken branch or jump the BTB did not know
+ */
+static unsigned int predict_control(const DecodedInst* d)
+{
+  unsigned int slot = (d->pc >> 2) & (predictor.btb_entries - 1);
+  unsigned int index;
+  int conditional = (d->kind == OP_beq || d->kind == OP_bne);
+  int taken = 1;
+  int predict_taken = 1;
+  address predicted = d->pc + sizeof(instruction);
+
+  if(conditional)
+  {
+    index = d->pc >> 2;
+    if(predictor.kind == GSHARE)
+      index ^= global_history;
+    index &= predictor.entries - 1;
+
+    taken = (PC != d->pc + sizeof(instruction));
+    predict_taken = (pattern_table[index] >= 2);
+    predictor.branches++;
+    if(predict_taken != taken)
+      predictor.mispredicted++;
+
+    if(taken && pattern_table[index] < 3)
+      pattern_table[index]++;
+    else if(!taken && pattern_table[index] > 0)
+      pattern_table[index]--;
+    global_history = ((global_history << 1) | taken) & (predictor.entries - 1);
+  }
+
+  if(predict_taken && btb[slot].pc == d->pc)
+    predicted = btb[slot].target;
+
+  if(taken)
+  {
+    predictor.redirects++;
+    if(predict_taken && predicted != PC)
+      predictor.btb_misses++;
+    btb[slot].pc = d->pc;
+    btb[slot].target = PC;
+  }
+
+  if(predicted == PC)
+    return 0;
+
+  fetch_wrong_path(predicted, predictor.wrong_path);
+  if((conditional && predict_taken != taken) || d->kind == OP_jr || d->kind == OP_jalr)
+    return pipeline.branch_penalty;
+  return 1;
+}
+
+/* Multi-core model, see MulticoreState in tips.h. The running core keeps
+   its state in PC, registers[] and hilo[], the others in contexts. */
+MulticoreState multicore = { 1, 1000 };
+
+static struct {
+  address pc;
+  word registers[32];
+  word hilo[2];
+} contexts[MAX_CORES];
+
+/* Instructions the running core has executed in its current quantum */
+static unsigned long long quantum_used;
+
+/* saves the running core and restores core in its place */
+static void switch_core(unsigned int core)
+{
+  contexts[multicore.current].pc = PC;
+  memcpy(contexts[multicore.current].registers, registers, sizeof(registers));
+  memcpy(contexts[multicore.current].hilo, hilo, sizeof(hilo));
+
+  PC = contexts[core].pc;
+  memcpy(registers, contexts[core].registers, sizeof(registers));
+  memcpy(hilo, contexts[core].hilo, sizeof(hilo));
+  cache = core_caches[partitions.mode == PARTITION_OFF ? core : 0];
+  multicore.current = core;
+  quantum_used = 0;
+  load_target = 0;
+}
+
+/* starts every core where the running one is, each with a stack of its own
+   below the previous core's and its number in $k0, then runs core 0 */
+static void start_cores()
+{
+  unsigned int core;
+
+  for(core = 0; core < multicore.cores; core++)
+  {
+    contexts[core].pc = PC;
+    memcpy(contexts[core].registers, registers, sizeof(registers));
+    memcpy(contexts[core].hilo, hilo, sizeof(hilo));
+    contexts[core].registers[29] -= core * CORE_STACK_BYTES;
+    contexts[core].registers[26] = core;
+    multicore.halted[core] = 0;
+  }
+
+  /* Core 0 is loaded as is, without saving the running core over it */
+  multicore.current = 0;
+  PC = contexts[0].pc;
+  memcpy(registers, contexts[0].registers, sizeof(registers));
+  cache = core_caches[0];
+  quantum_used = 0;
+}
+
+/*
+  Sets up cores cores sharing memory, taking turns every quantum
+  instructions, all starting at the current PC. The caches are drained and
+  the multi-core counters cleared.
+
+  returns 0 if successful, -1 if there are too many cores or no quantum
+ */
+int configure_cores(unsigned int cores, unsigned int quantum)
+{
+  if(cores == 0 || cores > MAX_CORES || quantum == 0)
+    return -1;
+
+  drain_cache();
+  multicore.cores = cores;
+  multicore.quantum = quantum;
+  start_cores();
+  reset_multicore_stats();
+  return 0;
+}
+
+void reset_multicore_stats()
+{
+  memset(multicore.instructions, 0, sizeof(multicore.instructions));
+  memset(multicore.hits, 0, sizeof(multicore.hits));
+  memset(multicore.misses, 0, sizeof(multicore.misses));
+  multicore.invalidations = 0;
+  multicore.interventions = 0;
+  multicore.upgrades = 0;
+}
+
+/* charges the running core with ran instructions, halts it if it reached
+   the sentinel and hands over to the next live core at the end of its
+   quantum; returns 0 once every core has halted */
+static int schedule_cores(unsigned long long ran)
+{
+  unsigned int core = multicore.current;
+
+  multicore.instructions[core] += ran;
+  quantum_used += ran;
+  if(sentinel_reached)
+  {
+    multicore.halted[core] = 1;
+    quantum_used = multicore.quantum;
+  }
+  if(quantum_used < multicore.quantum)
+    return 1;
+
+  do
+  {
+    core = (core + 1) % multicore.cores;
+    if(!multicore.halted[core])
+    {
+      switch_core(core);
+      return 1;
+    }
+  } while(core != multicore.current);
+
+  return 0;
+}
+
+/* Instructions run_processor() executes between refreshes of the displays
+   when it single steps */
+#define DISPLAY_INTERVAL 4096
+
+static void execute_step();
+
+/* Lets the register and cache displays catch up with the processor */
+static void publish_display()
+{
+  refresh_register_display();
+  refresh_cache_display();
+}
+
+/* Direct-mapped cache of decoded instructions, indexed by PC. An entry is
+   reused while the fetched word still matches; stores and loaders
+   invalidate it when the fetch itself is skipped, see step_processor(). */
+#define DECODE_CACHE_SIZE 4096
+static DecodedInst decode_cache[DECODE_CACHE_SIZE];
+
+/* fills d with inst, found at pc */
+static void decode_inst(DecodedInst* d, address pc, word inst)
+{
+  d->pc = pc;
+  d->inst = inst;
+  d->rs = getRs(inst);
+  d->rt = getRt(inst);
+  d->rd = getRd(inst);
+  d->shamt = getShamt(inst);
+  d->imm = getSImmed(inst);
+  d->kind = OP_nop;
 
   switch(getOpcode(inst))
   {
@@ -209,130 +699,453 @@ void execute_inst(word inst)
     switch(getFunct(inst))
     {
     case 0: /* sll */
-      rd = rt << getShamt(inst);
+      d->kind = OP_sll;
       break;
     case 2: /* srl */
-      rd = rt >> getShamt(inst);
+      d->kind = OP_srl;
       break;
-    case 3: /* sra */
-      rd = (int)(rt) >> rs;
+    case 3: /* sra, shifting by rs like srav */
+    case 7: /* srav */
+      d->kind = OP_srav;
       break;
     case 4: /* sllv */ 
-      rd = rt << rs;
+      d->kind = OP_sllv;
       break;
     case 6: /* srlv */
-      rd = rt >> rs;
-      break;
-    case 7: /* srav */
-      rd = (int)(rt) >> rs;
+      d->kind = OP_srlv;
       break;
     case 8: /* jr   */
-      PC = rs;
+      d->kind = OP_jr;
       break;
     case 9: /* jalr */
-      rd = PC;
-      PC = rs;
+      d->kind = OP_jalr;
       break;
     case 16: /* mfhi  */
-      rd = hi;
+      d->kind = OP_mfhi;
       break;
     case 17: /* mflo  */
-      rd = lo;
+      d->kind = OP_mflo;
       break;
     case 18: /* mthi  */
-      hi = rs;
+      d->kind = OP_mthi;
       break;
     case 19: /* mtlo  */
-      lo = rs;
+      d->kind = OP_mtlo;
       break;
     case 24: /* mult  */      
     case 25: /* multu */
-      lo = rs * rt;
+      d->kind = OP_mult;
       break;
     case 26: /* div   */
     case 27: /* divu  */
-      lo = rs / rt;
-      hi = rs % rt;
+      d->kind = OP_div;
       break;
     case 32: /* add   */
     case 33: /* addu  */
-      rd = rs + rt;
+      d->kind = OP_add;
       break;
     case 34: /* sub   */
     case 35: /* subu  */
-      rd = rs - rt;
+      d->kind = OP_sub;
       break;
     case 36: /* and   */
-      rd = rs & rt;
+      d->kind = OP_and;
       break;
     case 37: /* or    */
-      rd = rs | rt;
+      d->kind = OP_or;
       break;
     case 38: /* xor   */
-      rd = rs ^ rt;
+      d->kind = OP_xor;
       break;
     case 42: /* slt   */
     case 43: /* sltu  */
-      rd = (rs & 0x80000000) ^ (rt & 0x80000000) ? rs >> 31 : rs < rt;
+      d->kind = OP_slt;
       break;
-    default:
-      sprintf(buffer, "Unsupported instruction\n");
+    default: /* Unsupported instruction */
       break;
     }
     break;
   case 2: /* j     */
-    PC = jtarget;
-    break;
   case 3: /* jal   */
-    registers[31] = PC;
-    PC = jtarget;
+    d->kind = getOpcode(inst) == 2 ? OP_j : OP_jal;
+    d->target = ((pc + sizeof(instruction)) & 0xf0000000) | (getTarget(inst) << 2);
     break;
   case 4: /* beq   */
-    if(rs == rt)
-      PC = btarget;
-    break;
-  case 5: /* bne */
-    if(rs != rt)
-      PC = btarget;
+  case 5: /* bne   */
+    d->kind = getOpcode(inst) == 4 ? OP_beq : OP_bne;
+    d->target = pc + sizeof(instruction) + (getSImmed(inst) << 2);
     break;
   case 8: /* addi */
   case 9: /* addiu */
-    rt = rs + getSImmed(inst);
+    d->kind = OP_addi;
     break;
   case 10: /* slti  */
   case 11: /* sltiu */
-    rt = (rs & 0x80000000) ^ (getSImmed(inst) & 0x80000000) ? rs >> 31 : rs < getSImmed(inst);
+    d->kind = OP_slti;
     break;
   case 12: /* andi  */
-    rt = rs & getUImmed(inst);
+    d->kind = OP_andi;
+    d->imm = getUImmed(inst);
     break;
   case 13: /* ori */
-    rt = rs | getUImmed(inst);
+    d->kind = OP_ori;
+    d->imm = getUImmed(inst);
     break;
   case 15: /* lui */
-    rt = getUImmed(inst) << 16;
-    break;
-  case 32: /* lb */
-    sprintf(buffer, "Unsupported instruction, lb\n");
-    break;
-  case 36: /* lbu */
-    sprintf(buffer, "Unsupported instruction, lbu\n");
+    d->kind = OP_lui;
+    d->imm = getUImmed(inst) << 16;
     break;
   case 35: /* lw */
-    accessMemory(rs + getSImmed(inst), &rt, READ);
-    break;
-  case 40: /* sb */
-    sprintf(buffer, "Unsupported instruction, sb\n");
+    d->kind = OP_lw;
     break;
   case 43: /* sw */
-    accessMemory(rs + getSImmed(inst), &rt, WRITE);
+    d->kind = OP_sw;
     break;
   case 63:
-    stop_run();
+    d->kind = OP_done;
     break;
-  default:
-    sprintf(buffer, "Unsupported instruction\n");
+  default: /* Unsupported instruction, including lb, lbu and sb */
+    break;
+  }
+}
+
+/******************************************************************************
+   Basic blocks
+ *****************************************************************************/
+
+/* A straight-line run of instructions starting at pc and ending with a
+   branch, a jump, the sentinel or MAX_BLOCK_LENGTH instructions. ops ends
+   with an OP_end entry. next caches the blocks that last followed it. */
+#define MAX_BLOCK_LENGTH 32
+#define BLOCK_CACHE_SIZE 1024
+
+typedef struct Block {
+  address pc;
+  address end;
+  unsigned int length;
+  struct Block* next[2];
+  DecodedInst ops[MAX_BLOCK_LENGTH + 1];
+} Block;
+
+static Block block_cache[BLOCK_CACHE_SIZE];
+
+/* Range of addresses covered by translated blocks, for invalidation */
+static address code_low = 0xffffffff;
+static address code_high;
+
+unsigned long long instruction_count;
+int batch_fetches;
+
+static void flush_blocks()
+{
+  int i;
+
+  for(i = 0; i < BLOCK_CACHE_SIZE; i++)
+  {
+    block_cache[i].pc = NO_PC;
+    block_cache[i].next[0] = block_cache[i].next[1] = NULL;
+  }
+  code_low = 0xffffffff;
+  code_high = 0;
+}
+
+/* forgets every decoded instruction, e.g. after a program is loaded */
+void flush_decoded()
+{
+  int i;
+
+  for(i = 0; i < DECODE_CACHE_SIZE; i++)
+    decode_cache[i].pc = NO_PC;
+  flush_blocks();
+}
+
+/* forgets the decoded instruction at addr, which was just written */
+void invalidate_decoded(address addr)
+{
+  DecodedInst* d = &decode_cache[(addr >> 2) % DECODE_CACHE_SIZE];
+
+  if(d->pc == (addr & ~3))
+    d->pc = NO_PC;
+  if(addr >= code_low && addr < code_high)
+    flush_blocks();
+}
+
+/* translates the block starting at pc into b, reading the instructions
+   without any side effect; returns 0 if successful */
+static int translate_block(Block* b, address pc)
+{
+  word inst;
+
+  b->pc = NO_PC;
+  b->next[0] = b->next[1] = NULL;
+
+  for(b->length = 0; b->length < MAX_BLOCK_LENGTH; b->length++)
+  {
+    if(peekMemory(pc, &inst) != 0)
+      return -1;
+    decode_inst(&b->ops[b->length], pc, ntohl(inst));
+    pc += sizeof(instruction);
+    if(ENDS_BLOCK(b->ops[b->length].kind))
+    {
+      b->length++;
+      break;
+    }
+  }
+
+  b->ops[b->length].kind = OP_end;
+  b->ops[0].label = NULL;
+  b->pc = b->ops[0].pc;
+  b->end = pc;
+  if(b->pc < code_low)
+    code_low = b->pc;
+  if(b->end > code_high)
+    code_high = b->end;
+  return 0;
+}
+
+/* returns the translated block starting at pc, or NULL */
+static Block* find_block(address pc)
+{
+  Block* b = &block_cache[(pc >> 2) % BLOCK_CACHE_SIZE];
+
+  if(b->pc != pc && translate_block(b, pc) != 0)
+    return NULL;
+  return b;
+}
+
+/* issues the fetches of every instruction of b to the memory model in one
+   batch, after checking that memory still holds what was translated;
+   returns 0 if it does */
+static int fetch_block(Block* b)
+{
+  unsigned int i;
+  word inst;
+
+  for(i = 0; i < b->length; i++)
+  {
+    if(peekMemory(b->ops[i].pc, &inst) != 0 || ntohl(inst) != b->ops[i].inst)
+    {
+      b->pc = NO_PC;
+      return -1;
+    }
+  }
+
+  access_type = FETCH;
+  for(i = 0; i < b->length; i++)
+  {
+    access_pc = b->ops[i].pc;
+    accessMemory(access_pc, &inst, READ);
+    if(trace_active)
+      trace_event(EVENT_INST, access_pc, READ, sizeof(instruction), HIT, 0, 0, b->ops[i].inst);
+  }
+  return 0;
+}
+
+/*
+  Executes count instructions on the running core, or fewer if the
+  sentinel is reached first, and returns how many were executed. Whole
+  basic blocks are run with direct-threaded dispatch while nothing observes
+  instruction fetches, or when batch_fetches allows handing a block's
+  fetches to the memory model ahead of its data accesses. Single steps are
+  used otherwise, when instructions are logged, timed or predicted, in the
+  GUI and for a block longer than what is left of count.
+ */
+static unsigned long long run_core(unsigned long long count)
+{
+  unsigned long long executed = 0;
+  const DecodedInst* d;
+  Block* b = NULL;
+  Block* next;
+  address start;
+  unsigned int i;
+
+#ifdef __GNUC__
+#define OP_LABEL_ENTRY(name, ...) &&do_##name,
+  static const void* const labels[] = { OPERATIONS(OP_LABEL_ENTRY) &&do_end };
+#endif
+
+  sentinel_reached = 0;
+  if(IS_GUI_ACTIVE() || LOG_ENABLED(LOG_INSTRUCTIONS) || TIMING() || PREDICTING() || (FETCH_OBSERVED() && !batch_fetches))
+  {
+    while(executed < count && !sentinel_reached)
+    {
+      flush_drawlist();
+      execute_step();
+      executed++;
+      if(executed % DISPLAY_INTERVAL == 0)
+        publish_display();
+    }
+    publish_display();
+    return executed;
+  }
+
+  while(executed < count && !sentinel_reached)
+  {
+    /* Follow the chain from the previous block, else look it up */
+    next = NULL;
+    if(b != NULL && b->next[0] != NULL && b->next[0]->pc == PC)
+      next = b->next[0];
+    else if(b != NULL && b->next[1] != NULL && b->next[1]->pc == PC)
+      next = b->next[1];
+    else if((next = find_block(PC)) != NULL && b != NULL)
+    {
+      b->next[1] = b->next[0];
+      b->next[0] = next;
+    }
+
+    b = next;
+    if(b == NULL || b->length > count - executed || (FETCH_OBSERVED() && fetch_block(b) != 0))
+    {
+      flush_drawlist();
+      execute_step();
+      executed++;
+      b = NULL;
+      continue;
+    }
+
+    if(b->ops[0].label == NULL)
+    {
+#ifdef __GNUC__
+      for(i = 0; i <= b->length; i++)
+        b->ops[i].label = labels[b->ops[i].kind];
+#endif
+    }
+
+    /* The only control transfer is the last instruction, which sees PC
+       past itself */
+    PC = b->end;
+    d = b->ops;
+    start = b->pc;
+
+    /* A store into the running block ends it, the rest is fetched again */
+#undef CODE_WRITTEN
+#define CODE_WRITTEN(addr) if((addr) >= start && (addr) < PC) goto code_written;
+
+#ifdef __GNUC__
+#define OP_LABEL(name, ...) do_##name: { __VA_ARGS__; } registers[0] = 0; d++; goto *d->label;
+    goto *d->label;
+    OPERATIONS(OP_LABEL)
+  do_end:
+#else
+#define OP_CASE(name, ...) case OP_##name: { __VA_ARGS__; } registers[0] = 0; d++; break;
+    while(d->kind != OP_end)
+    {
+      switch(d->kind)
+      {
+        OPERATIONS(OP_CASE)
+      }
+    }
+#endif
+
+    executed += b->length;
+    instruction_count += b->length;
+    continue;
+
+  code_written:
+    registers[0] = 0;
+    PC = d->pc + sizeof(instruction);
+    executed += d - b->ops + 1;
+    instruction_count += d - b->ops + 1;
+    b = NULL;
+  }
+#undef CODE_WRITTEN
+#define CODE_WRITTEN(addr)
+
+  publish_display();
+  return executed;
+}
+
+/* runs the current core until it is about to execute pc, see run_until() */
+static unsigned long long run_core_until(address pc, unsigned long long count)
+{
+  unsigned long long executed = 0;
+
+  sentinel_reached = 0;
+  while(executed < count && PC != pc && !sentinel_reached)
+  {
+    flush_drawlist();
+    execute_step();
+    executed++;
+    if(executed % DISPLAY_INTERVAL == 0)
+      publish_display();
+  }
+
+  publish_display();
+  return executed;
+}
+
+/*
+  Executes up to count instructions, stopping before the one at pc or after
+  the sentinel, and returns how many were executed. Steps one instruction
+  at a time since pc may lie in the middle of a basic block. With several
+  cores, each runs its quantum in turn until one of them gets to pc.
+ */
+unsigned long long run_until(address pc, unsigned long long count)
+{
+  unsigned long long executed = 0;
+  unsigned long long chunk;
+  unsigned long long ran;
+
+  if(multicore.cores <= 1)
+    return run_core_until(pc, count);
+
+  while(executed < count && !multicore.halted[multicore.current])
+  {
+    chunk = multicore.quantum - quantum_used;
+    if(chunk > count - executed)
+      chunk = count - executed;
+
+    ran = run_core_until(pc, chunk);
+    executed += ran;
+    if(PC == pc && !sentinel_reached)
+    {
+      /* Stay on the core that got there, it is switched out by the next run
+         if its quantum is used up */
+      multicore.instructions[multicore.current] += ran;
+      quantum_used += ran;
+      break;
+    }
+    if(!schedule_cores(ran))
+      break;
+  }
+  return executed;
+}
+
+/*
+  Executes count instructions, or fewer if the sentinel is reached first,
+  and returns how many were executed. With several cores, each runs its
+  quantum in turn until count is reached or every core has halted.
+ */
+unsigned long long run_processor(unsigned long long count)
+{
+  unsigned long long executed = 0;
+  unsigned long long chunk;
+  unsigned long long ran;
+
+  if(multicore.cores <= 1)
+    return run_core(count);
+
+  while(executed < count && !multicore.halted[multicore.current])
+  {
+    chunk = multicore.quantum - quantum_used;
+    if(chunk > count - executed)
+      chunk = count - executed;
+
+    ran = run_core(chunk);
+    executed += ran;
+    if(!schedule_cores(ran))
+      break;
   }
+  return executed;
+}
+
+/* runs inst, the instruction before PC */
+void execute_inst(word inst)
+{
+  DecodedInst d;
+
+  decode_inst(&d, PC - sizeof(instruction), inst);
+  handlers[d.kind](&d);
 
   /* Ensure $zero remains equal to 0 */
   registers[0] = 0;
@@ -340,38 +1153,98 @@ void execute_inst(word inst)
 
 void reinit_processor()
 {
-  PC = PROGRAM_START;
+  PC = entry_point;
+  flush_decoded();
   registers[29] = STACK_START;
-  registers[31] = PROGRAM_START;
+  registers[31] = entry_point;
+  if(multicore.cores > 1)
+    start_cores();
   refresh_register_display();
 }
 
-void step_processor()
+/*
+  Fetches, logs and executes the instruction at PC. Only the core of a
+  step, the displays are left to the callers so that bulk runs can refresh
+  them every DISPLAY_INTERVAL instructions rather than after each one.
+ */
+static void execute_step()
 {
   char buffer[200];
+  DecodedInst* d;
   word inst;
+  unsigned long long mark = 0;
+  unsigned long long fetch_stall = 0;
+  unsigned long long data_stall = 0;
+  unsigned int redirect = 0;
 
-  /* Flush previously drawn items */
-  flush_drawlist();
+  /* Fetch Instruction, unless it is already decoded and nothing would
+     observe the fetch */
+  if(TIMING())
+    mark = MEMORY_CYCLES();
 
-  /* Fetch Instruction */
-  accessMemory(PC, &inst, READ);
-  inst = ntohl(inst);
+  access_type = FETCH;
+  access_pc = PC;
+  d = &decode_cache[(PC >> 2) % DECODE_CACHE_SIZE];
+  if(d->pc != PC || FETCH_OBSERVED())
+  {
+    accessMemory(PC, &inst, READ);
+    inst = ntohl(inst);
+    if(d->pc != PC || d->inst != inst)
+      decode_inst(d, PC, inst);
+  }
+  inst = d->inst;
+
+  if(TIMING())
+  {
+    fetch_stall = MEMORY_CYCLES() - mark + UNCACHED_CYCLES();
+    mark = MEMORY_CYCLES();
+  }
+
+  if(trace_active)
+    trace_event(EVENT_INST, PC, READ, sizeof(instruction), HIT, 0, 0, inst);
 
   /* Print PC */
-  sprintf(buffer, "[0x%08X]: 0x%08X\t", PC, inst);
-  append_log(buffer);
+  if(LOG_ENABLED(LOG_INSTRUCTIONS))
+  {
+    sprintf(buffer, "[0x%08X]: 0x%08X\t", PC, inst);
+    append_log(buffer);
+  }
 
   /* Increment PC */
   PC += sizeof(instruction); 
 
   /* Disassemble Instruction */
-  disassemble_inst(inst);
+  if(LOG_ENABLED(LOG_INSTRUCTIONS))
+    disassemble_inst(inst);
 
   /* Execute Instruction */
-  execute_inst(inst);
-  
+  handlers[d->kind](d);
+  instruction_count++;
+
+  /* Ensure $zero remains equal to 0 */
+  registers[0] = 0;
+
+  if(TIMING())
+    data_stall = MEMORY_CYCLES() - mark + (d->kind == OP_lw || d->kind == OP_sw ? UNCACHED_CYCLES() : 0);
+
+  /* Predict branches and jumps, possibly fetching down the wrong path */
+  if(ENDS_BLOCK(d->kind) && d->kind != OP_done)
+    redirect = (PREDICTING() ? predict_control(d) : static_redirect(d));
+
+  if(TIMING())
+    time_instruction(d, redirect, fetch_stall, data_stall);
+}
+
+void step_processor()
+{
+  /* Flush previously drawn items */
+  flush_drawlist();
+
+  sentinel_reached = 0;
+  execute_step();
+  if(multicore.cores > 1)
+    schedule_cores(1);
+
   /* refresh registers and cache */
-  refresh_register_display();
-  refresh_cache_display();
+  publish_display();
 }
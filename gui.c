@@ -51,6 +51,7 @@ GtkWidget* register_canvas;
 GtkWidget* textbox_scroll_window;
 GtkWidget* textbox;
 GtkTextMark* mark;
+gboolean scroll_pending = FALSE;
 
 /* Configure dialog related variables */
 GtkWidget* assoc_entry;
@@ -66,6 +67,8 @@ MemorySyncPolicy panel_memory_sync_policy;
 GtkWidget* index_view_button;
 GtkWidget* assoc_view_button;
 CacheView panel_cache_view;
+GtkWidget* heatmap_button;
+gboolean panel_heatmap;
 
 /* Run Dialog related variables */
 GtkWidget* speed_slider;
@@ -97,6 +100,10 @@ gint cache_unit_height;
 
 gint horizontal_line_width;
 
+/* Set rows are shaded by their share of the peak per-set miss count */
+gboolean heatmap_active;
+GdkGC* heatmap_gc;
+
 PangoLayout* layout;
 PangoFontDescription* fontdesc;
 PangoFontMetrics* metrics;
@@ -225,6 +232,15 @@ gboolean log_event(GtkWidget *widget, GdkEventExpose *event, gpointer data)
   return TRUE;
 }
 
+/* Scrolls the log to its end once the main loop is idle, so a burst of
+   appended lines costs a single scroll */
+gboolean scroll_log(gpointer data)
+{
+  gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(textbox), mark, 0, FALSE, 0, 0);
+  scroll_pending = FALSE;
+  return FALSE;
+}
+
 void append_log(char* msg)
 {
   GtkTextBuffer* buffer;
@@ -240,9 +256,13 @@ void append_log(char* msg)
   buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textbox));
   gtk_text_buffer_get_end_iter(buffer, &iter);
 
-  /* Inserts msg and scrolls to new insertion */
+  /* Inserts msg, the scroll to the new insertion is deferred */
   gtk_text_buffer_insert(buffer, &iter, msg, -1);
-  gtk_text_view_scroll_to_mark(GTK_TEXT_VIEW(textbox), mark, 0, FALSE, 0, 0);
+  if(!scroll_pending)
+  {
+    scroll_pending = TRUE;
+    g_idle_add(scroll_log, NULL);
+  }
 }
 
 GtkWidget* build_log_panel()
@@ -351,6 +371,38 @@ void configure_cache_drawing_parameters(GtkWidget* widget)
   horizontal_line_width = block_header_width + block_data_width + byte_width;
 }
 
+unsigned long long heatmap_peak()
+{
+  unsigned long long peak = 0;
+  gint b;
+
+  for(b = 0; b < set_count; b++)
+    if(set_stats[b].misses > peak)
+      peak = set_stats[b].misses;
+
+  return peak;
+}
+
+void draw_heatmap_row(GtkWidget* widget, gint set_num, unsigned long long peak, gint y, gint height)
+{
+  GdkColor color;
+  guint16 fade;
+
+  if(!heatmap_active || peak == 0 || set_stats[set_num].misses == 0)
+    return;
+
+  if(heatmap_gc == NULL)
+    heatmap_gc = gdk_gc_new(widget->window);
+
+  /* Fade from white to red as the set approaches the peak miss count */
+  fade = 0xffff - (guint16)(0xffff * set_stats[set_num].misses / peak);
+  color.red = 0xffff;
+  color.green = fade;
+  color.blue = fade;
+  gdk_gc_set_rgb_fg_color(heatmap_gc, &color);
+  gdk_draw_rectangle(widget->window, heatmap_gc, TRUE, base_x_offset, y, horizontal_line_width - base_x_offset, height);
+}
+
 gboolean draw_cache_display_index(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
   gint s;
@@ -362,6 +414,7 @@ gboolean draw_cache_display_index(GtkWidget *widget, GdkEventExpose *event, gpoi
 
   gchar buffer[250];
   gsize buffer_size;
+  unsigned long long peak = heatmap_peak();
 
   node* current;
 
@@ -415,6 +468,8 @@ gboolean draw_cache_display_index(GtkWidget *widget, GdkEventExpose *event, gpoi
 
   for(b = 0; b < set_count; b++)
   {
+    draw_heatmap_row(widget, b, peak, y_offset, assoc * line_height);
+
     for(s = 0; s < assoc; s++)
     {
       buffer_size = sprintf(buffer, block_header_text, b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
@@ -557,6 +612,7 @@ gboolean draw_cache_display_assoc (GtkWidget *widget, GdkEventExpose *event, gpo
 
   gchar buffer[250];
   gsize buffer_size;
+  unsigned long long peak = heatmap_peak();
 
   node* current;
 
@@ -611,6 +667,7 @@ gboolean draw_cache_display_assoc (GtkWidget *widget, GdkEventExpose *event, gpo
 
     for(b = 0; b < set_count; b++)
     {      
+      draw_heatmap_row(widget, b, peak, y_offset, line_height);
       buffer_size = sprintf(buffer, block_header_text, b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
       pango_layout_set_text(layout, buffer, buffer_size);
       gdk_draw_layout(widget->window, 
@@ -951,6 +1008,13 @@ gboolean index_view_listener(GtkWidget* widget, gpointer data)
   return TRUE;
 }
 
+gboolean heatmap_listener(GtkWidget* widget, gpointer data)
+{
+  panel_heatmap = GTK_TOGGLE_BUTTON(widget)->active;
+
+  return TRUE;
+}
+
 GtkWidget* build_arrange_panel(void)
 {
   GtkWidget* frame;
@@ -966,9 +1030,15 @@ GtkWidget* build_arrange_panel(void)
   assoc_view_button = gtk_radio_button_new_with_label(gtk_radio_button_get_group(GTK_RADIO_BUTTON(index_view_button)), "Associativity Based");
   g_signal_connect(G_OBJECT(assoc_view_button), "clicked", G_CALLBACK(assoc_view_listener), NULL);
 
+  /* Build heatmap check button */
+  heatmap_button = gtk_check_button_new_with_label("Color Sets by Miss Intensity");
+  g_signal_connect(G_OBJECT(heatmap_button), "clicked", G_CALLBACK(heatmap_listener), NULL);
+
   /* Pack the radio buttons */
   gtk_box_pack_start(GTK_BOX(box), index_view_button, TRUE, TRUE, 0);
   gtk_box_pack_start(GTK_BOX(box), assoc_view_button, TRUE, TRUE, 0);
+  gtk_box_pack_start(GTK_BOX(box), heatmap_button, TRUE, TRUE, 0);
+  gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(heatmap_button), panel_heatmap = heatmap_active);
 
   /* Initialize radio buttons */
   switch(panel_cache_view = view)
@@ -1189,6 +1259,7 @@ gboolean configure_button_listener(GtkWidget *widget, GdkEventExpose *event, gpo
     memory_sync_policy = panel_memory_sync_policy;
     assert(panel_cache_view == INDEX || panel_cache_view == ASSOC);
     view = panel_cache_view;
+    heatmap_active = panel_heatmap;
 
     sprintf(buffer, "Cache parameters changed:\n + set count = %d\n + associativity = %d\n + block size = %d\n + replacement policy = %s\n + memory sync policy = %s\n", set_count, assoc, block_size, (policy == RANDOM ? "Random" : (policy == LRU ? "LRU" : "LFU")), (memory_sync_policy == WRITE_BACK ? "Write Back" : "Write Through"));
     append_log(buffer);
@@ -1402,6 +1473,50 @@ gboolean reset_cache_button_listener(GtkWidget *widget, GdkEventExpose *event, g
   return TRUE;
 }
 
+gboolean trace_button_listener(GtkWidget *widget, GdkEventExpose *event, gpointer data)
+{
+  static LogLevel saved_level;
+  gchar buffer[300];
+  unsigned long long available;
+  unsigned long long i;
+
+  if(GTK_TOGGLE_BUTTON(widget)->active)
+  {
+    /* Record binary events instead of formatting text on every step */
+    if(configure_trace(1 << 16) != 0)
+    {
+      append_log("--Unable to allocate trace buffer--\n");
+      return TRUE;
+    }
+    saved_level = log_level;
+    if(log_level > LOG_SUMMARY)
+      log_level = LOG_SUMMARY;
+    append_log("--Tracing started--\n");
+    return TRUE;
+  }
+
+  if(!trace_active)
+    return TRUE;
+
+  /* Decode what was recorded into the log panel */
+  available = trace_available();
+  if(trace_dropped() != 0)
+  {
+    sprintf(buffer, "(%llu older events overwritten)\n", trace_dropped());
+    append_log(buffer);
+  }
+  for(i = 0; i < available; i++)
+  {
+    format_trace_event(buffer, i);
+    append_log(buffer);
+  }
+
+  configure_trace(0);
+  log_level = saved_level;
+  append_log("--Tracing stopped--\n");
+  return TRUE;
+}
+
 gboolean reset_output_button_listener(GtkWidget *widget, GdkEventExpose *event, gpointer data)
 {
   GtkTextBuffer* buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(textbox));
@@ -1421,6 +1536,7 @@ GtkWidget* build_button_panel()
   GtkWidget* load_button;
   GtkWidget* step_button;
   GtkWidget* run_button;
+  GtkWidget* trace_button;
 
   GtkWidget* reset_frame;
   GtkWidget* reset_machine_button;
@@ -1440,6 +1556,7 @@ GtkWidget* build_button_panel()
   load_button = gtk_button_new_with_label("Load Program");
   step_button = gtk_button_new_with_label("Step");
   run_button = gtk_button_new_with_label("Run");
+  trace_button = gtk_toggle_button_new_with_label("Trace");
   reset_machine_button = gtk_button_new_with_label("CPU");
   reset_cache_button = gtk_button_new_with_label("Cache");
   reset_output_button = gtk_button_new_with_label("Output");
@@ -1451,6 +1568,7 @@ GtkWidget* build_button_panel()
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), load_button, "Loads a new file and resets CPU", NULL);
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), step_button, "Execute only the next instruction of the loaded program", NULL);
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), run_button, "Execute the loaded program", NULL);
+  gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), trace_button, "Record execution quietly; release to show the trace in the log", NULL);
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), reset_machine_button, "Reset the CPU to allow re-execution of loaded program", NULL);
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), reset_cache_button, "Flushes the contents of the cache", NULL);
   gtk_tooltips_set_tip(GTK_TOOLTIPS(button_panel_tooltips), reset_output_button, "Clears the log", NULL);
@@ -1461,16 +1579,18 @@ GtkWidget* build_button_panel()
   g_signal_connect(G_OBJECT(load_button), "clicked", G_CALLBACK(load_button_listener), NULL);
   g_signal_connect(G_OBJECT(step_button), "clicked", G_CALLBACK(step_button_listener), NULL);
   g_signal_connect(G_OBJECT(run_button), "clicked", G_CALLBACK(run_button_listener), NULL);
+  g_signal_connect(G_OBJECT(trace_button), "toggled", G_CALLBACK(trace_button_listener), NULL);
   g_signal_connect(G_OBJECT(reset_machine_button), "clicked", G_CALLBACK(reset_machine_button_listener), NULL);
   g_signal_connect(G_OBJECT(reset_cache_button), "clicked", G_CALLBACK(reset_cache_button_listener), NULL);
   g_signal_connect(G_OBJECT(reset_output_button), "clicked", G_CALLBACK(reset_output_button_listener), NULL);
   g_signal_connect_swapped(G_OBJECT(quit_button), "clicked", G_CALLBACK(gtk_widget_destroy), G_OBJECT(main_window));
 
   /* Build table */
-  test_table = gtk_table_new(1, 3, TRUE);
+  test_table = gtk_table_new(1, 4, TRUE);
   gtk_table_attach_defaults(GTK_TABLE(test_table), load_button, 0, 1, 0, 1);
   gtk_table_attach_defaults(GTK_TABLE(test_table), step_button, 1, 2, 0, 1);
   gtk_table_attach_defaults(GTK_TABLE(test_table), run_button, 2, 3, 0, 1);
+  gtk_table_attach_defaults(GTK_TABLE(test_table), trace_button, 3, 4, 0, 1);
 
   reset_table = gtk_table_new(1, 3, TRUE);
   gtk_table_attach_defaults(GTK_TABLE(reset_table), reset_machine_button, 0, 1, 0, 1);
@@ -1554,6 +1674,8 @@ int build_gui(int argc, char** argv)
   base_display_variables_initialized = FALSE;
   timer_active = FALSE;
   drawlist = NULL;
+  heatmap_active = FALSE;
+  heatmap_gc = NULL;
 
   /* Initialize window */
   main_window = gtk_window_new (GTK_WINDOW_TOPLEVEL);
@@ -1,7 +1,9 @@
 #include "tips.h"
+#include "util.h"
 
 /* Define Cache Parameters */
-cacheSet cache[MAX_SETS];
+cacheSet core_caches[MAX_CORES][MAX_SETS];
+cacheSet* cache = core_caches[0];
 unsigned int block_size;
 unsigned int set_count;
 unsigned int assoc;
@@ -16,127 +18,644 @@ void init_memory()
 
 void flush_cache() 
 {
+  cacheSet* running = cache;
+  int core;
   int set_index;
   int block_index;
 
-  /* for each set */
-  for( set_index=0; set_index < set_count; set_index++ )
+  /* for each core */
+  for( core=0; core < MAX_CORES; core++ )
   {
-    /* for each block in the set */
-    for( block_index=0; block_index < assoc; block_index++ ) 
+    cache = core_caches[core];
+
+    /* for each set */
+    for( set_index=0; set_index < set_count; set_index++ )
     {
-      cache[set_index].block[block_index].valid = INVALID;
-      cache[set_index].block[block_index].dirty = VIRGIN;
-      init_lru(set_index, block_index);
-      init_lfu(set_index, block_index);
+      /* for each block in the set */
+      for( block_index=0; block_index < assoc; block_index++ ) 
+      {
+        cache[set_index].block[block_index].valid = INVALID;
+        cache[set_index].block[block_index].dirty = VIRGIN;
+        init_lru(set_index, block_index);
+        init_lfu(set_index, block_index);
+      }
     }
   }
+
+  cache = running;
+  clear_directory();
+}
+
+/* Page table
+   ==========
+   A radix tree over the virtual page number, root level first. Interior
+   levels hold pointers to the next level, the last level holds a frame
+   number plus one so that 0 means unmapped. Tables are allocated when a
+   page under them is first touched, and frames are handed out in the order
+   pages are first touched.
+*/
+static void* page_root;
+static unsigned int page_bits = 14;           /* log2 of the page size */
+static unsigned int page_levels = 2;
+static unsigned int level_bits[MAX_PAGE_LEVELS] = {9, 9};
+static unsigned int frames_used;
+
+/* Physical memory
+   ===============
+   Sparse over the whole 32-bit physical address space: a frame is allocated,
+   zeroed, when a page is first mapped to it, so resident memory only grows
+   with the pages a program touches. frame_table maps a frame number to its
+   storage and frame_pages to the virtual page mapped to it; both double in
+   size as needed.
+*/
+static byte** frame_table;
+static word* frame_pages;
+static unsigned int frame_table_size;
+
+/* Direct-mapped cache of recent translations for the simulator's own
+   lookups. It is not part of the TLB model and is never counted. */
+#define TRANSLATION_CACHE_SIZE 64
+static struct {
+  word virtual_page;                          /* plus one, 0 when empty */
+  word frame;
+} translation_cache[TRANSLATION_CACHE_SIZE];
+
+/* TLB model, see configure_tlb() */
+TlbStats tlb_stats;
+static struct TlbEntry {
+  int valid;
+  word virtual_page;
+  unsigned long long last_use;
+  unsigned long long uses;
+} tlb[MAX_TLB_ENTRIES];
+static unsigned long long tlb_clock;
+
+/* DRAM timing model, see configure_dram()
+
+   Timing is kept apart from the data, which is always moved at once. Each
+   transfer becomes a request that arrives at dram_clock, and every channel
+   serves its queue FR-FCFS: among the requests that have arrived, the oldest
+   one hitting an open row goes first, else the oldest one. */
+#define DRAM_BUS_BYTES 8                      /* bytes moved per cycle */
+#define NO_ROW 0xffffffff
+
+DramStats dram_stats;
+static unsigned long long dram_clock;
+
+typedef struct {
+  unsigned int bank;
+  unsigned int row;
+  unsigned int size;
+  WriteEnable flag;
+  unsigned long long arrival;
+} DramRequest;
+
+static struct DramChannel {
+  DramRequest queue[MAX_DRAM_QUEUE];          /* in order of arrival */
+  unsigned int count;
+  unsigned long long bus_free;
+  unsigned int open_row[MAX_DRAM_BANKS];
+  unsigned long long bank_free[MAX_DRAM_BANKS];
+} dram_channels[MAX_DRAM_CHANNELS];
+
+static void free_page_table(void** table, unsigned int level)
+{
+  unsigned int i;
+
+  if(table == NULL)
+    return;
+
+  if(level + 1 < page_levels)
+    for(i = 0; i < (1u << level_bits[level]); i++)
+      free_page_table((void**)table[i], level + 1);
+
+  free(table);
+}
+
+/* returns the frame holding virtual_page, mapping it to a new frame on
+   first touch, or -1 if memory for it cannot be allocated */
+static int walk_page_table(word virtual_page)
+{
+  void** slot = &page_root;
+  word* entry = NULL;
+  unsigned int shift = 32 - page_bits;
+  unsigned int level;
+  unsigned int index;
+  size_t size;
+
+  for(level = 0; level < page_levels; level++)
+  {
+    size = level + 1 < page_levels ? sizeof(void*) : sizeof(word);
+    if(*slot == NULL && !(*slot = calloc(1u << level_bits[level], size)))
+      return -1;
+
+    shift -= level_bits[level];
+    index = (virtual_page >> shift) & ((1u << level_bits[level]) - 1);
+    if(level + 1 < page_levels)
+      slot = (void**)*slot + index;
+    else
+      entry = (word*)*slot + index;
+  }
+
+  if(*entry == 0)
+  {
+    if(frames_used == frame_table_size)
+    {
+      unsigned int size = frame_table_size == 0 ? 64 : frame_table_size * 2;
+      byte** table = (byte**) realloc(frame_table, size * sizeof(byte*));
+      word* pages;
+
+      if(table == NULL)
+        return -1;
+      frame_table = table;
+      if(!(pages = (word*) realloc(frame_pages, size * sizeof(word))))
+        return -1;
+      frame_pages = pages;
+      frame_table_size = size;
+    }
+
+    if(!(frame_table[frames_used] = (byte*) calloc(1, 1u << page_bits)))
+      return -1;
+    frame_pages[frames_used] = virtual_page;
+    *entry = ++frames_used;
+  }
+
+  return *entry - 1;
 }
 
 static int translateAddress(address virtual_addr, address* physical_addr)
 {
-  static struct PageTableEntry {
-    word virtual_page_number;
-    word physical_page_number;
-  } pagetable[PAGE_TABLE_SIZE] =
-    { {PROGRAM_START / PHYSICAL_PAGE_SIZE, 0},
-      {GLOBAL_START / PHYSICAL_PAGE_SIZE, 1},
-      {0x00000000 / PHYSICAL_PAGE_SIZE, 2},
-      {STACK_START / PHYSICAL_PAGE_SIZE, 3}
-    };
-
-  word i;
-  word virtual_page;
-  word offset;
+  word virtual_page = virtual_addr >> page_bits;
+  unsigned int slot = virtual_page % TRANSLATION_CACHE_SIZE;
+  int frame;
+
+  if(translation_cache[slot].virtual_page != virtual_page + 1)
+  {
+    if((frame = walk_page_table(virtual_page)) == -1)
+    {
+      if(LOG_ENABLED(LOG_SUMMARY))
+        append_log("Unable to access memory address\n");
+      return -1;
+    }
+
+    translation_cache[slot].virtual_page = virtual_page + 1;
+    translation_cache[slot].frame = frame;
+  }
+
+  *physical_addr = (translation_cache[slot].frame << page_bits) | (virtual_addr & ((1u << page_bits) - 1));
+  return 0;
+}
+
+/*
+  Replaces the page table by an empty one with pages of page_bytes split
+  over levels; every page is unmapped, so the program has to be reloaded.
+  The bits of the virtual page number are split evenly over the levels,
+  with any remainder going to the levels closest to the root.
+
+  returns 0 if successful, -1 if the layout is not supported
+ */
+int configure_page_table(unsigned int page_bytes, unsigned int levels)
+{
+  unsigned int bits = uint_log2(page_bytes);
+  unsigned int level;
+
+  if(page_bytes != (1u << bits) || page_bytes < 256 || page_bytes > MAX_PAGE_SIZE)
+    return -1;
+  if(levels == 0 || levels > MAX_PAGE_LEVELS || levels > 32 - bits)
+    return -1;
+
+  free_page_table((void**)page_root, 0);
+  page_root = NULL;
+  while(frames_used > 0)
+    free(frame_table[--frames_used]);
+
+  page_bits = bits;
+  page_levels = levels;
+  for(level = 0; level < levels; level++)
+    level_bits[level] = (32 - bits) / levels + (level < (32 - bits) % levels);
+
+  memset(translation_cache, 0, sizeof(translation_cache));
+  configure_tlb(tlb_stats.entries, tlb_stats.assoc, tlb_stats.policy, tlb_stats.walk_latency);
+  return 0;
+}
+
+void get_page_table_info(unsigned int* page_bytes, unsigned int* levels, unsigned int* frames_in_use)
+{
+  *page_bytes = 1u << page_bits;
+  *levels = page_levels;
+  *frames_in_use = frames_used;
+}
+
+/*
+  Models a TLB of entries translations in sets of assoc ways in front of
+  the page table. Each miss walks every level of the page table at a cost
+  of walk_latency cycles per level. 0 entries turns the model off.
+
+  returns 0 if successful, -1 if the geometry is not supported
+ */
+int configure_tlb(unsigned int entries, unsigned int assoc, ReplacementPolicy policy, unsigned int walk_latency)
+{
+  if(entries != 0 && (entries > MAX_TLB_ENTRIES || assoc == 0 || entries % assoc != 0))
+    return -1;
+
+  memset(tlb, 0, sizeof(tlb));
+  tlb_clock = 0;
+  tlb_stats.entries = entries;
+  tlb_stats.assoc = assoc;
+  tlb_stats.policy = policy;
+  tlb_stats.walk_latency = walk_latency;
+  reset_tlb_stats();
+  return 0;
+}
+
+void reset_tlb_stats()
+{
+  memset(tlb_stats.hits, 0, sizeof(tlb_stats.hits));
+  memset(tlb_stats.misses, 0, sizeof(tlb_stats.misses));
+  tlb_stats.walk_cycles = 0;
+}
+
+/* looks up the page of addr in the TLB model on behalf of access_type */
+void access_tlb(address addr)
+{
+  word virtual_page = addr >> page_bits;
+  struct TlbEntry* set;
+  struct TlbEntry* victim;
+  unsigned int way;
+
+  if(tlb_stats.entries == 0)
+    return;
+
+  set = tlb + (virtual_page % (tlb_stats.entries / tlb_stats.assoc)) * tlb_stats.assoc;
+  tlb_clock++;
+
+  for(way = 0; way < tlb_stats.assoc; way++)
+  {
+    if(set[way].valid && set[way].virtual_page == virtual_page)
+    {
+      tlb_stats.hits[access_type]++;
+      set[way].last_use = tlb_clock;
+      set[way].uses++;
+      return;
+    }
+  }
+
+  tlb_stats.misses[access_type]++;
+  tlb_stats.walk_cycles += (unsigned long long)page_levels * tlb_stats.walk_latency;
+
+  /* Fill an empty way if there is one, else evict by policy */
+  victim = NULL;
+  for(way = 0; way < tlb_stats.assoc && victim == NULL; way++)
+    if(!set[way].valid)
+      victim = set + way;
+
+  if(victim == NULL && tlb_stats.policy == RANDOM)
+    victim = set + randomint(tlb_stats.assoc);
+
+  /* LFU breaks ties on recency, like the cache does */
+  if(victim == NULL)
+  {
+    victim = set;
+    for(way = 1; way < tlb_stats.assoc; way++)
+    {
+      if(tlb_stats.policy == LFU && set[way].uses != victim->uses)
+      {
+        if(set[way].uses < victim->uses)
+          victim = set + way;
+      }
+      else if(set[way].last_use < victim->last_use)
+        victim = set + way;
+    }
+  }
+
+  victim->valid = 1;
+  victim->virtual_page = virtual_page;
+  victim->last_use = tlb_clock;
+  victim->uses = 1;
+}
+
+/*
+  Models DRAM with channels of banks of row_bytes rows. A row hit costs
+  t_cas, an access to a precharged bank t_rcd + t_cas, and a conflict with
+  another open row t_rp + t_rcd + t_cas, plus the transfer on the bus.
+  Pending requests are dropped.
+
+  returns 0 if successful, -1 if the organization is not supported
+ */
+int configure_dram(unsigned int channels, unsigned int banks, unsigned int row_bytes, unsigned int t_rcd, unsigned int t_cas, unsigned int t_rp, int closed_page, unsigned int queue_depth)
+{
+  unsigned int channel;
+  unsigned int bank;
+
+  if(channels == 0 || channels > MAX_DRAM_CHANNELS || banks == 0 || banks > MAX_DRAM_BANKS)
+    return -1;
+  if(row_bytes < MAX_BLOCK_SIZE || row_bytes != (1u << uint_log2(row_bytes)))
+    return -1;
+  if(queue_depth == 0 || queue_depth > MAX_DRAM_QUEUE)
+    return -1;
+
+  memset(dram_channels, 0, sizeof(dram_channels));
+  for(channel = 0; channel < channels; channel++)
+    for(bank = 0; bank < banks; bank++)
+      dram_channels[channel].open_row[bank] = NO_ROW;
+
+  dram_clock = 0;
+  dram_stats.enabled = 1;
+  dram_stats.channels = channels;
+  dram_stats.banks = banks;
+  dram_stats.row_bytes = row_bytes;
+  dram_stats.t_rcd = t_rcd;
+  dram_stats.t_cas = t_cas;
+  dram_stats.t_rp = t_rp;
+  dram_stats.closed_page = closed_page;
+  dram_stats.queue_depth = queue_depth;
+  reset_dram_stats();
+  return 0;
+}
+
+void reset_dram_stats()
+{
+  dram_stats.requests = 0;
+  dram_stats.reads = 0;
+  dram_stats.row_hits = 0;
+  dram_stats.row_empty = 0;
+  dram_stats.row_conflicts = 0;
+  dram_stats.latency = 0;
+  dram_stats.read_latency = 0;
+}
+
+/* returns the number of requests still waiting in the channel queues */
+unsigned int dram_pending()
+{
+  unsigned int channel;
+  unsigned int pending = 0;
+
+  for(channel = 0; channel < dram_stats.channels; channel++)
+    pending += dram_channels[channel].count;
+
+  return pending;
+}
+
+/* serves queue[pick] of channel starting no earlier than now */
+static void serveDRAMRequest(struct DramChannel* channel, unsigned int pick, unsigned long long now)
+{
+  DramRequest* request = channel->queue + pick;
+  unsigned int bank = request->bank;
+  unsigned long long start = now > channel->bank_free[bank] ? now : channel->bank_free[bank];
+  unsigned long long done;
+  unsigned int cycles = dram_stats.t_cas;
+
+  if(channel->open_row[bank] == request->row)
+    dram_stats.row_hits++;
+  else if(channel->open_row[bank] == NO_ROW)
+  {
+    dram_stats.row_empty++;
+    cycles += dram_stats.t_rcd;
+  }
+  else
+  {
+    dram_stats.row_conflicts++;
+    cycles += dram_stats.t_rp + dram_stats.t_rcd;
+  }
+
+  /* The data bus is shared by the banks of a channel */
+  done = start + cycles;
+  if(done < channel->bus_free)
+    done = channel->bus_free;
+  done += (request->size + DRAM_BUS_BYTES - 1) / DRAM_BUS_BYTES;
+  channel->bus_free = done;
 
-  virtual_page = virtual_addr / PHYSICAL_PAGE_SIZE;
-  offset = virtual_addr % PHYSICAL_PAGE_SIZE;
+  if(dram_stats.closed_page)
+  {
+    channel->open_row[bank] = NO_ROW;
+    channel->bank_free[bank] = done + dram_stats.t_rp;
+  }
+  else
+  {
+    channel->open_row[bank] = request->row;
+    channel->bank_free[bank] = done;
+  }
+
+  dram_stats.requests++;
+  dram_stats.latency += done - request->arrival;
+  if(request->flag == READ)
+  {
+    dram_stats.reads++;
+    dram_stats.read_latency += done - request->arrival;
+  }
+
+  channel->count--;
+  memmove(request, request + 1, (channel->count - pick) * sizeof(DramRequest));
+}
 
-  for(i = 0; i < PAGE_TABLE_SIZE; i++)
+/* serves the requests of channel that can start by until, or at least
+   one request if force is set */
+static void scheduleDRAM(struct DramChannel* channel, unsigned long long until, int force)
+{
+  unsigned long long now;
+  unsigned int pick;
+  unsigned int i;
+
+  while(channel->count > 0)
   {
-    if(pagetable[i].virtual_page_number == virtual_page)
+    now = channel->bus_free > channel->queue[0].arrival ? channel->bus_free : channel->queue[0].arrival;
+    if(now > until && !force)
+      return;
+
+    /* First ready: the oldest request to an open row, else the oldest */
+    pick = 0;
+    for(i = 0; i < channel->count && channel->queue[i].arrival <= now; i++)
     {
-      *physical_addr = pagetable[i].physical_page_number * PHYSICAL_PAGE_SIZE + offset;
-      return 0;
+      if(channel->open_row[channel->queue[i].bank] == channel->queue[i].row)
+      {
+        pick = i;
+        break;
+      }
     }
+
+    serveDRAMRequest(channel, pick, now);
+    force = 0;
+  }
+}
+
+/* queues the timing of a transfer of size bytes at physical address addr */
+static void queueDRAMRequest(address addr, unsigned int size, WriteEnable flag)
+{
+  unsigned int row = addr / dram_stats.row_bytes;
+  struct DramChannel* channel = dram_channels + row % dram_stats.channels;
+  DramRequest* request;
+
+  row /= dram_stats.channels;
+  scheduleDRAM(channel, dram_clock, 0);
+  /* A full queue stalls whoever is issuing until a request leaves it */
+  if(channel->count == dram_stats.queue_depth)
+  {
+    scheduleDRAM(channel, dram_clock, 1);
+    if(dram_clock < channel->bus_free)
+      dram_clock = channel->bus_free;
+  }
+
+  request = channel->queue + channel->count++;
+  request->bank = row % dram_stats.banks;
+  request->row = row / dram_stats.banks;
+  request->size = size;
+  request->flag = flag;
+  request->arrival = dram_clock;
+}
+
+/* advances the time at which new DRAM requests arrive */
+void tick_dram(unsigned int cycles)
+{
+  dram_clock += cycles;
+}
+
+/*
+  Returns where the byte at addr lives in backing memory, mapping its page on
+  first touch, and sets bytes to how many bytes follow it in the same page.
+  Meant for loaders filling memory in bulk: nothing is timed, traced or
+  logged.
+
+  returns NULL if the page could not be mapped
+ */
+byte* mapDRAM(address addr, unsigned int* bytes)
+{
+  address phys_addr;
+
+  if(translateAddress(addr, &phys_addr) == -1)
+    return NULL;
+
+  *bytes = (1u << page_bits) - (phys_addr & ((1u << page_bits) - 1));
+  return frame_table[phys_addr >> page_bits] + (phys_addr & ((1u << page_bits) - 1));
+}
+
+/* returns the storage of frame, and sets addr to the virtual address of
+   the page mapped to it, or returns NULL past the last mapped frame */
+byte* get_frame(unsigned int frame, address* addr)
+{
+  if(frame >= frames_used)
+    return NULL;
+
+  *addr = frame_pages[frame] << page_bits;
+  return frame_table[frame];
+}
+
+/* moves one burst without announcing it; returns 0 if successful */
+static int moveDRAM(address addr, byte* data, unsigned int bytes, WriteEnable flag)
+{
+  address phys_addr;
+  byte* memory;
+
+  if(bytes == 0 || bytes > MAX_BLOCK_SIZE || bytes != (1u << uint_log2(bytes)) ||
+     (addr & ((1u << page_bits) - 1)) + bytes > (1u << page_bits))
+  {
+    if(LOG_ENABLED(LOG_SUMMARY))
+      append_log("Invalid burst size for accessDRAM\n");
+    return -1;
+  }
+
+  /* Convert virtual address into physical address */
+  if(translateAddress(addr, &phys_addr) == -1)
+    return -1;
+
+  /* Do memory action */
+  memory = frame_table[phys_addr >> page_bits] + (phys_addr & ((1u << page_bits) - 1));
+  switch(flag)
+  {
+  case READ:
+    memcpy(data, memory, bytes);
+    break;
+  case WRITE:
+    memcpy(memory, data, bytes);
+    break;
+  default:
+    if(LOG_ENABLED(LOG_SUMMARY))
+      append_log("Invalid flag for accessDRAM\n");
+    return -1;
   }
 
-  append_log("Unable to access memory address\n");
-  return -1;
+  if(dram_stats.enabled)
+    queueDRAMRequest(phys_addr, bytes, flag);
+
+  if(trace_active)
+    trace_event(EVENT_DRAM, addr, flag, bytes, HIT, 0, 0, 0);
+
+  return 0;
+}
+
+static void announceDRAM(char* buffer)
+{
+  if(!IS_GUI_ACTIVE())
+    printf(buffer);
+  else
+    append_log(buffer);
+}
+
+int burstDRAM(address addr, byte* data, unsigned int bytes, WriteEnable flag)
+{
+  char buffer[200];
+  int error = moveDRAM(addr, data, bytes, flag);
+
+  /* Announce memory access */
+  if(error || !LOG_ENABLED(LOG_DRAM))
+    return error;
+
+  sprintf(buffer, "%s %u bytes at 0x%08X\n", flag == READ ? "Accessing" : "Updating", bytes, addr);
+  announceDRAM(buffer);
+  return 0;
+}
+
+int burstDRAMLines(const address* addrs, byte* const* data, unsigned int lines, unsigned int bytes, WriteEnable flag)
+{
+  char buffer[200];
+  unsigned int line;
+  int failed = 0;
+
+  for(line = 0; line < lines; line++)
+    if(moveDRAM(addrs[line], data[line], bytes, flag) != 0)
+      failed++;
+
+  if(lines == 0 || !LOG_ENABLED(LOG_DRAM))
+    return failed;
+
+  sprintf(buffer, "%s %u lines of %u bytes from 0x%08X\n", flag == READ ? "Accessing" : "Updating", lines, bytes, addrs[0]);
+  announceDRAM(buffer);
+  return failed;
 }
 
 int accessDRAM(address addr, byte* data, TransferUnit mode, WriteEnable flag)
 {
-  static byte DRAM[PHYSICAL_PAGE_COUNT * PHYSICAL_PAGE_SIZE];
-  static char* reading = "Accessing";
-  static char* writing = "Updating";
 #ifdef CYGWIN
   static instruction self_branch = 0xffff0010;
 #else
   static instruction self_branch = 0x0100ffff;
 #endif
-  char buffer[200];
-  int transfer_size;
-  address phys_addr;
+  unsigned int transfer_size;
   int error = 0;
-  char* memory_action;
-  
+
   /* Determine number of bytes involved in memory access */
   switch(mode)
   {
   case BYTE_SIZE:
-    transfer_size = 1;
-    break;
   case HALF_WORD_SIZE:
-    transfer_size = 2;
-    break;
   case WORD_SIZE:
-    transfer_size = 4;
-    break;
   case DOUBLEWORD_SIZE:
-    transfer_size = 8;
-    break;
   case QUADWORD_SIZE:
-    transfer_size = 16;
-    break;
   case OCTWORD_SIZE:
-    transfer_size = 32;
+    transfer_size = 1u << mode;
     break;
   default:
-    append_log("Invalid transfer mode for accessDRAM\nDefaulting to moving only 1 byte");
+    if(LOG_ENABLED(LOG_SUMMARY))
+      append_log("Invalid transfer mode for accessDRAM\nDefaulting to moving only 1 byte");
+    transfer_size = 1;
     error = 1;
   }
 
-  /* Convert virtual address into physical address */
-  if(translateAddress(addr, &phys_addr) == -1)
-  {    
+  if(burstDRAM(addr, data, transfer_size, flag) != 0)
+  {
     if(flag == READ && mode == WORD_SIZE)
       memcpy(data, &self_branch, sizeof(instruction));
     return -1;
   }
 
-  /* Do memory action */
-  switch(flag)
-  {
-  case READ:        
-    memcpy(data, DRAM + phys_addr, transfer_size);
-    memory_action = reading;
-    break;
-  case WRITE:
-    memcpy(DRAM + phys_addr, data, transfer_size);
-    memory_action = writing;
-    break;
-  default:
-    append_log("Invalid flag for accessDRAM\n");
-    error = 1;
-  }
-
-  /* Announce memory access */
-  sprintf(buffer, "%s %u bytes at 0x%08X\n", memory_action, transfer_size, addr);
-  if(!IS_GUI_ACTIVE())
-    printf(buffer);
-  else
-    append_log(buffer);
-
   return error;
 }
@@ -1,7 +1,10 @@
 #include "tips.h"
+#include "util.h"
 #include <signal.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <netinet/in.h>
+#include <time.h>
 
 /******************************************************************************
    String Tokenizer definitions
@@ -49,6 +52,9 @@ void destroy_tokenizer(StringTokenizer* st)
 
 int run_active;
 
+/* Instructions run_to_completion() executes between checks for Ctrl-C */
+#define RUN_CHECK_INTERVAL (1 << 16)
+
 void catch(int sig)
 {
   if(sig != SIGINT)
@@ -57,106 +63,1171 @@ void catch(int sig)
   if(run_active == 1)
     run_active = 0;
   else
-    exit(sig);
+    exit(sig);
+}
+
+void display_regs()
+{
+  static char* register_display[] = { 
+    "R00: %08x\tR08: %08x\tR16: %08x\tR24: %08x\n",
+    "R01: %08x\tR09: %08x\tR17: %08x\tR25: %08x\n",
+    "R02: %08x\tR10: %08x\tR18: %08x\tR26: %08x\n",
+    "R03: %08x\tR11: %08x\tR19: %08x\tR27: %08x\n",
+    "R04: %08x\tR12: %08x\tR20: %08x\tR28: %08x\n",
+    "R05: %08x\tR13: %08x\tR21: %08x\tR29: %08x\n",
+    "R06: %08x\tR14: %08x\tR22: %08x\tR30: %08x\n",
+    "R07: %08x\tR15: %08x\tR23: %08x\tR31: %08x\n",
+    " PC: %08x\n"
+  };
+
+  int i;
+
+  printf("\n");
+  if(multicore.cores > 1)
+    printf("Core %u of %u\n", multicore.current, multicore.cores);
+  for(i = 0; i < 8; i++)
+    printf(register_display[i], registers[i], registers[i + 8], registers[i + 16], registers[i+24]);
+
+  /* Display PC */
+  printf(register_display[i], PC);
+  printf("\n");
+}
+
+void display_cache()
+{
+  int s;
+  int b;
+  int o;
+
+  /* Setup cache view */
+  printf("\n");
+  
+  if(assoc == 0 || set_count == 0 || block_size == 0)
+  {
+    printf("Some cache parameters are set to 0\n  + Assoc: %u\n  + Set Count: %u\n  + Block Size: %u\n\n", assoc, set_count, block_size);
+    return;
+  }
+
+  switch(view)
+  {
+  case INDEX:
+    printf("Set V D  LRU\tLFU\tTag\n=== = =  ===\t===\t===\n");
+    for(b = 0; b < set_count; b++)
+    {
+      for(s = 0; s < assoc; s++)
+      {
+	printf("%2d  %d %d  %s\t%s\t%08x    ", b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
+	for(o = 0; o < block_size; o++)
+	{
+	  printf("%02x", cache[b].block[s].data[o]);
+
+	  if((o + 1) != block_size)
+	  {
+	    if((o + 1) % 4 == 0)
+	      printf(" | ");
+	    else if((o + 1) % 2 == 0)
+	      printf(" ");
+	  }
+	}
+	printf("\n");
+      }
+      printf("\n");
+    }
+    break;
+  case ASSOC:
+    for(s = 0; s < assoc; s++)
+    {
+      printf("Unit #%u\n\nBlk V D  LRU\tLFU\tTag\n=== = =  ===\t===\t===\n", s);
+
+      for(b = 0; b < set_count; b++)
+      {
+	printf("%2d  %d %d  %s\t%s\t%08x    ", b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
+	for(o = 0; o < block_size; o++)
+	{
+	  printf("%02x", cache[b].block[s].data[o]);
+
+	  if((o + 1) != block_size)
+	  {
+	    if((o + 1) % 4 == 0)
+	      printf(" | ");
+	    else if((o + 1) % 2 == 0)
+	      printf(" ");
+	  }
+	}
+	printf("\n");
+	if((b + 1) % 4 == 0)
+	  printf("\n");
+      }
+    }
+    break;
+  default:
+    printf("Invalid cache arrangement");
+    exit(1);
+  }
+
+}
+
+void display_tlb()
+{
+  unsigned long long hits = tlb_stats.hits[FETCH] + tlb_stats.hits[DATA];
+  unsigned long long misses = tlb_stats.misses[FETCH] + tlb_stats.misses[DATA];
+
+  printf("\nTLB: %u entries, %u-way\n", tlb_stats.entries, tlb_stats.assoc);
+  printf("TLB hits: %llu (%llu fetch, %llu data)\n", hits, tlb_stats.hits[FETCH], tlb_stats.hits[DATA]);
+  printf("TLB misses: %llu (%llu fetch, %llu data)\n", misses, tlb_stats.misses[FETCH], tlb_stats.misses[DATA]);
+  if(hits + misses != 0)
+  {
+    printf("TLB miss rate: %.4f\n", (double)misses / (hits + misses));
+    printf("Page walk cycles: %llu (%.3f per access)\n", tlb_stats.walk_cycles, (double)tlb_stats.walk_cycles / (hits + misses));
+  }
+}
+
+void display_dram()
+{
+  printf("\nDRAM: %u channels x %u banks, %u byte rows, %s page, tRCD %u tCAS %u tRP %u\n",
+         dram_stats.channels, dram_stats.banks, dram_stats.row_bytes, dram_stats.closed_page ? "closed" : "open",
+         dram_stats.t_rcd, dram_stats.t_cas, dram_stats.t_rp);
+  printf("DRAM requests: %llu (%llu reads, %u still queued)\n", dram_stats.requests, dram_stats.reads, dram_pending());
+  if(dram_stats.requests == 0)
+    return;
+
+  printf("Row buffer: %llu hits, %llu empty, %llu conflicts (hit rate %.4f)\n", dram_stats.row_hits, dram_stats.row_empty,
+         dram_stats.row_conflicts, (double)dram_stats.row_hits / dram_stats.requests);
+  printf("Average latency: %.2f cycles\n", (double)dram_stats.latency / dram_stats.requests);
+  if(dram_stats.reads != 0)
+    printf("Average miss (read) latency: %.2f cycles\n", (double)dram_stats.read_latency / dram_stats.reads);
+}
+
+void display_pipeline()
+{
+  double n = (double)pipeline.instructions;
+
+  printf("\nPipeline: hit %u cycles, miss penalty %u, branch penalty %u\n",
+         pipeline.hit_latency, pipeline.miss_penalty, pipeline.branch_penalty);
+  printf("Cycles: %llu for %llu instructions\n", pipeline.cycles, pipeline.instructions);
+  if(pipeline.instructions == 0)
+    return;
+
+  printf("CPI: %.3f = 1.000 base + %.3f fill + %.3f load-use + %.3f branch + %.3f I-cache + %.3f D-cache\n",
+         pipeline.cycles / n, 4 / n, pipeline.load_use / n, pipeline.branch / n, pipeline.fetch / n, pipeline.data / n);
+}
+
+void display_predictor()
+{
+  printf("\nBranch predictor: %s, %u counters, %u BTB entries, %u wrong-path fetches\n",
+         predictor.kind == GSHARE ? "gshare" : "bimodal", predictor.entries, predictor.btb_entries, predictor.wrong_path);
+  printf("Conditional branches: %llu (%llu mispredicted", predictor.branches, predictor.mispredicted);
+  if(predictor.branches != 0)
+    printf(", accuracy %.4f", 1 - (double)predictor.mispredicted / predictor.branches);
+  printf(")\n");
+  printf("Taken branches and jumps: %llu (%llu BTB misses)\n", predictor.redirects, predictor.btb_misses);
+  if(predictor.wrong_path != 0)
+    printf("Wrong-path fetches: %llu\n", predictor.wrong_path_fetches);
+}
+
+void display_directory()
+{
+  unsigned int pointer_bits = (multicore.cores > 1 ? uint_log2(multicore.cores - 1) + 1 : 1);
+  unsigned int entry_bits;
+
+  /* Two state bits, plus a bit per core or the pointers and an overflow bit */
+  if(directory.pointers == 0)
+    entry_bits = 2 + multicore.cores;
+  else
+    entry_bits = 2 + directory.pointers * pointer_bits + 1;
+
+  if(directory.pointers == 0)
+    printf("\nDirectory: full bit vector, %u bits per entry", entry_bits);
+  else
+    printf("\nDirectory: %u pointers, %u bits per entry", directory.pointers, entry_bits);
+  if(block_size != 0)
+    printf(", %.2f%% of a %u byte block", 100.0 * entry_bits / (block_size * 8), block_size);
+  printf("\n");
+  printf("Entries: %u in use, %u at most (%.1f KB)\n", directory.entries, directory.peak_entries,
+         directory.peak_entries * (double)entry_bits / 8 / 1024);
+  printf("Requests: %llu (%llu three-hop", directory.requests, directory.three_hop);
+  if(directory.requests != 0)
+    printf(", %.4f of all", (double)directory.three_hop / directory.requests);
+  printf(")\n");
+  printf("Invalidating requests: %llu, %llu invalidations sent", directory.invalidating, directory.invalidations_sent);
+  if(directory.invalidating != 0)
+    printf(" (fan-out %.2f on average, %u at most)", (double)directory.invalidations_sent / directory.invalidating, directory.max_fanout);
+  printf("\n");
+  if(directory.pointers != 0)
+    printf("Broadcasts after pointer overflow: %llu\n", directory.broadcasts);
+}
+
+void display_multicore()
+{
+  unsigned int core;
+
+  printf("\nCores: %u, quantum %u instructions\n", multicore.cores, multicore.quantum);
+  for(core = 0; core < multicore.cores; core++)
+  {
+    unsigned long long accesses = multicore.hits[core] + multicore.misses[core];
+
+    printf("Core %u: %llu instructions", core, multicore.instructions[core]);
+    if(accesses != 0)
+      printf(", hit rate %.4f", (double)multicore.hits[core] / accesses);
+    printf("%s\n", multicore.halted[core] ? ", halted" : "");
+  }
+  printf("Coherence: %llu invalidations, %llu interventions, %llu upgrades\n",
+         multicore.invalidations, multicore.interventions, multicore.upgrades);
+
+  if(directory.enabled)
+    display_directory();
+}
+
+void display_partitions()
+{
+  unsigned int core;
+  int way;
+
+  if(partitions.mode == PARTITION_UCP)
+    printf("\nPartitions: UCP every %u accesses, %llu repartitions\n", partitions.interval, partitions.repartitions);
+  else
+    printf("\nPartitions: static way masks\n");
+
+  for(core = 0; core < multicore.cores; core++)
+  {
+    unsigned int mask = partitions.masks[core] & ((1u << assoc) - 1);
+
+    printf("Core %u: ways ", core);
+    for(way = assoc - 1; way >= 0; way--)
+      printf("%c", (mask == 0 || (mask & (1u << way))) ? '1' : '0');
+    if(partitions.mode == PARTITION_UCP)
+    {
+      printf(", utility");
+      for(way = 0; way < assoc; way++)
+        printf(" %llu", partitions.utility[core][way]);
+    }
+    printf("\n");
+  }
+}
+
+void display_stats()
+{
+  printf("\nAccesses: %llu (%llu reads, %llu writes)\n", cache_stats.accesses, cache_stats.reads, cache_stats.writes);
+  printf("Hits: %llu\nMisses: %llu\nWritebacks: %llu\n", cache_stats.hits, cache_stats.misses, cache_stats.writebacks);
+  if(cache_stats.accesses != 0)
+    printf("Miss rate: %.4f\n", (double)cache_stats.misses / cache_stats.accesses);
+
+  if(tlb_stats.entries != 0)
+    display_tlb();
+
+  if(dram_stats.enabled)
+    display_dram();
+
+  if(multicore.cores > 1)
+    display_multicore();
+
+  if(partitions.mode != PARTITION_OFF)
+    display_partitions();
+
+  if(predictor.enabled)
+    display_predictor();
+
+  if(pipeline.enabled)
+    display_pipeline();
+}
+
+void display_sampling()
+{
+  double mean;
+  double variance;
+  double half_width;
+  unsigned long long total;
+
+  if(!sampling.enabled)
+  {
+    printf("\nSampling is off\n");
+    return;
+  }
+
+  total = sampling.warmed + sampling.detailed;
+  printf("\nSampling period %u, warmup %u, window %u\n", sampling.period, sampling.warmup, sampling.window);
+  printf("Accesses: %llu (%llu warmed, %llu detailed)\n", total, sampling.warmed, sampling.detailed);
+  printf("Measurement windows: %llu\n", sampling.units);
+
+  if(sampling.units < 2)
+  {
+    printf("Not enough windows for an estimate\n");
+    return;
+  }
+
+  /* 95% confidence interval from the spread of per-window miss rates */
+  mean = sampling.sum / sampling.units;
+  variance = (sampling.sum_squares - sampling.units * mean * mean) / (sampling.units - 1);
+  half_width = 1.96 * square_root(variance / sampling.units);
+  printf("Estimated miss rate: %.4f +/- %.4f (95%% confidence)\n", mean, half_width);
+  if(mean > 0)
+    printf("Relative error bound: %.2f%%\n", 100 * half_width / mean);
+}
+
+void display_set_sampling()
+{
+  unsigned int sets = 0;
+  int i;
+  unsigned long long sampled = 0;
+  unsigned long long misses = 0;
+  unsigned long long writebacks = 0;
+  SetCounters* counters;
+  double rate;
+
+  if(set_sampling.ratio <= 1)
+  {
+    printf("\nSet sampling is off\n");
+    return;
+  }
+
+  for(i = 0; i < set_count; i++)
+  {
+    if(!is_sampled_set(i))
+      continue;
+    counters = &set_stats[i];
+    sampled += counters->hits + counters->misses;
+    misses += counters->misses;
+    writebacks += counters->dirty_evictions;
+    sets++;
+  }
+
+  printf("\nSimulating %u of %u sets (1 in %u, hashed)%s\n", sets, set_count, set_sampling.ratio,
+         set_sampling.check ? ", checked against every set" : "");
+  printf("Accesses: %llu (%llu to sampled sets)\n", set_sampling.accesses, sampled);
+
+  if(sampled == 0)
+  {
+    printf("No accesses to sampled sets yet\n");
+    return;
+  }
+
+  /* Scaled up from the sampled sets alone. Traffic is rarely spread evenly
+     over the at most MAX_SETS sets, so this is a rough figure; 'setsample
+     <N> check' measures how far off it is for a given program */
+  rate = (double)misses / sampled;
+  printf("Estimated writebacks: %.0f\n", (double)writebacks * set_sampling.accesses / sampled);
+  printf("Estimated misses: %.0f\n", rate * set_sampling.accesses);
+  printf("Estimated miss rate: %.4f\n", rate);
+
+  if(!set_sampling.check)
+  {
+    printf("With only %u sets sampled the estimate can be off by a factor of two\n", sets);
+    printf("or more, use 'setsample %u check' to measure the error\n", set_sampling.ratio);
+    return;
+  }
+
+  printf("Actual writebacks: %llu\n", cache_stats.writebacks);
+  printf("Actual misses: %llu\n", cache_stats.misses);
+  if(cache_stats.accesses > 0)
+    printf("Actual miss rate: %.4f\n", (double)cache_stats.misses / cache_stats.accesses);
+  if(cache_stats.misses > 0)
+    printf("Miss estimate error: %+.2f%%\n",
+           100 * (rate * set_sampling.accesses - cache_stats.misses) / cache_stats.misses);
+}
+
+void display_heatmap()
+{
+  static char* shades = " .:-=+*#%@";
+  unsigned long long peak = 0;
+  unsigned long long accesses;
+  int shade;
+  int b;
+  int i;
+
+  if(set_count == 0)
+  {
+    printf("\nNo cache sets configured\n");
+    return;
+  }
+
+  for(b = 0; b < set_count; b++)
+    if(set_stats[b].misses > peak)
+      peak = set_stats[b].misses;
+
+  printf("\nSet Hits      Misses    Evicts    Dirty     Miss heat (peak %llu)\n", peak);
+  printf("=== ====      ======    ======    =====     =========\n");
+  for(b = 0; b < set_count; b++)
+  {
+    accesses = set_stats[b].hits + set_stats[b].misses;
+    shade = peak == 0 ? 0 : (int)((set_stats[b].misses * 9 + peak - 1) / peak);
+
+    printf("%2d  %-9llu %-9llu %-9llu %-9llu |", b, set_stats[b].hits, set_stats[b].misses, set_stats[b].evictions, set_stats[b].dirty_evictions);
+    for(i = 0; i < 32; i++)
+      putchar(peak == 0 ? ' ' : (i < (int)(set_stats[b].misses * 32 / peak) ? shades[shade] : ' '));
+    printf("| %.2f\n", accesses == 0 ? 0.0 : (double)set_stats[b].misses / accesses);
+  }
+}
+
+void display_evictions(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  EvictionPair* pairs;
+  int count;
+  int found;
+  int i;
+
+  count = strlen(command) == 0 ? 10 : atoi(command);
+  if(count < 1)
+    count = 10;
+
+  pairs = (EvictionPair*) malloc(count * sizeof(EvictionPair));
+  found = get_eviction_pairs(pairs, count);
+
+  printf("\nSet Tag       Evicted   Count\n=== ===       =======   =====\n");
+  for(i = 0; i < found; i++)
+    printf("%2u  %08x  %08x  %llu\n", pairs[i].set, pairs[i].tag, pairs[i].victim, pairs[i].count);
+
+  if(found == 0)
+    printf("No evictions recorded\n");
+
+  free(pairs);
+}
+
+void display_sharing(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  SharedBlock* blocks;
+  unsigned long long total;
+  int count;
+  int found;
+  int i;
+  int pc;
+
+  if(!sharing_profile.enabled)
+  {
+    printf("False sharing detection is off, see 'sharing'\n");
+    return;
+  }
+
+  count = strlen(command) == 0 ? 10 : atoi(command);
+  if(count < 1)
+    count = 10;
+
+  total = sharing_profile.true_invalidations + sharing_profile.false_invalidations;
+  printf("\nSharing at %u byte granularity over %u blocks\n", sharing_profile.block_bytes, sharing_profile.blocks);
+  printf("Invalidations: %llu (%llu true sharing, %llu false sharing", total,
+         sharing_profile.true_invalidations, sharing_profile.false_invalidations);
+  if(total != 0)
+    printf(", %.4f false", (double)sharing_profile.false_invalidations / total);
+  printf(")\n");
+
+  blocks = (SharedBlock*) malloc(count * sizeof(SharedBlock));
+  found = get_shared_blocks(blocks, count);
+
+  /* Shared and Own count the words written by several cores and by one */
+  printf("\nBlock     Sharing  True      False     Writers Shared Own   PCs\n");
+  printf("=====     =======  ====      =====     ======= ====== ===   ===\n");
+  for(i = 0; i < found; i++)
+  {
+    printf("%08x  %-7s  %-9llu %-9llu %-7u %-6u %-5u", blocks[i].addr,
+           blocks[i].true_invalidations == 0 ? "false" : blocks[i].false_invalidations == 0 ? "true" : "both",
+           blocks[i].true_invalidations, blocks[i].false_invalidations,
+           count_bits(blocks[i].writers), blocks[i].shared_words, blocks[i].private_words);
+    for(pc = 0; pc < MAX_SHARING_PCS && blocks[i].pc_invalidations[pc] != 0; pc++)
+      printf(" %08x(%llu)", blocks[i].pcs[pc], blocks[i].pc_invalidations[pc]);
+    printf("\n");
+  }
+
+  if(found == 0)
+    printf("No invalidations recorded\n");
+
+  free(blocks);
+}
+
+void export_statistics(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  char* filename;
+  FILE* file;
+  EvictionPair* pairs;
+  int sets = strcmp(command, "sets") == 0;
+  int found;
+  int i;
+
+  if(!sets && strcmp(command, "evictions") != 0)
+  {
+    printf("Can only export 'sets' or 'evictions'\n");
+    return;
+  }
+
+  filename = nextToken(tokenizer);
+  if(strlen(filename) == 0)
+  {
+    printf("Please specify a file.\n");
+    return;
+  }
+
+  if(!(file = fopen(filename, "w")))
+  {
+    printf("Unable to open [%s]\n", filename);
+    return;
+  }
+
+  if(sets)
+  {
+    fprintf(file, "set,hits,misses,evictions,dirty_evictions\n");
+    for(i = 0; i < set_count; i++)
+      fprintf(file, "%d,%llu,%llu,%llu,%llu\n", i, set_stats[i].hits, set_stats[i].misses, set_stats[i].evictions, set_stats[i].dirty_evictions);
+    found = set_count;
+  }
+  else
+  {
+    found = count_eviction_pairs();
+    pairs = (EvictionPair*) malloc((found + 1) * sizeof(EvictionPair));
+    found = get_eviction_pairs(pairs, found);
+
+    fprintf(file, "set,tag,evicted_tag,count\n");
+    for(i = 0; i < found; i++)
+      fprintf(file, "%u,0x%08x,0x%08x,%llu\n", pairs[i].set, pairs[i].tag, pairs[i].victim, pairs[i].count);
+    free(pairs);
+  }
+
+  fclose(file);
+  printf("Wrote %d rows to [%s]\n", found, filename);
+}
+
+void configure_set_sampler(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int ratio;
+  int check;
+
+  if(strcmp(command, "off") == 0)
+    ratio = 1;
+  else if(strlen(command) == 0)
+  {
+    printf("Insufficient arguments\n");
+    return;
+  }
+  else
+    ratio = atoi(command);
+  check = strcmp(nextToken(tokenizer), "check") == 0;
+
+  if(ratio > 1 && pipeline.enabled)
+    printf("Turn off 'pipeline' first, it cannot time bypassed accesses\n");
+  else if(ratio < 1 || configure_set_sampling(ratio, check) != 0)
+    printf("Set sampling ratio must be between 1 and the set count\n");
+  else if(ratio == 1)
+    printf("Set sampling off\n");
+  else if(check)
+    printf("Estimating from 1 in %d sets, still simulating all of them, cache drained\n", ratio);
+  else
+    printf("Simulating 1 in %d sets, cache drained\n", ratio);
+}
+
+void display_reuse_profile()
+{
+  char label[48];
+  int type;
+  int bucket;
+  int last = 0;
+
+  if(!reuse_profile.enabled)
+  {
+    printf("\nReuse profiling is off\n");
+    return;
+  }
+
+  printf("\nReuse distances at %u byte granularity\n", reuse_profile.block_bytes);
+  printf("Fetch accesses: %llu (%llu cold)\n", reuse_profile.accesses[FETCH], reuse_profile.cold[FETCH]);
+  printf("Data accesses: %llu (%llu cold)\n", reuse_profile.accesses[DATA], reuse_profile.cold[DATA]);
+
+  for(type = FETCH; type <= DATA; type++)
+    for(bucket = 0; bucket < REUSE_BUCKETS; bucket++)
+      if(reuse_profile.stack_histogram[type][bucket] != 0 || reuse_profile.time_histogram[type][bucket] != 0)
+	if(bucket > last)
+	  last = bucket;
+
+  printf("\n%-24s%-16s%-16s%-16s%s\n", "Distance", "Fetch stack", "Fetch time", "Data stack", "Data time");
+  for(bucket = 0; bucket <= last; bucket++)
+  {
+    if(bucket == 0)
+      sprintf(label, "0");
+    else
+      sprintf(label, "[%llu, %llu)", 1ULL << (bucket - 1), 1ULL << bucket);
+
+    printf("%-24s%-16llu%-16llu%-16llu%llu\n", label,
+	   reuse_profile.stack_histogram[FETCH][bucket], reuse_profile.time_histogram[FETCH][bucket],
+	   reuse_profile.stack_histogram[DATA][bucket], reuse_profile.time_histogram[DATA][bucket]);
+  }
+}
+
+void display_hot_pcs(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  char buffer[200];
+  PcCounters* hot;
+  word inst;
+  LogLevel level;
+  int count;
+  int found;
+  int i;
+
+  count = strlen(command) == 0 ? 10 : atoi(command);
+  if(count < 1)
+    count = 10;
+
+  hot = (PcCounters*) malloc(count * sizeof(PcCounters));
+  found = get_hot_pcs(hot, count);
+
+  printf("\nPC\t\tAccesses\tMisses\t\tWritebacks\tInstruction\n");
+  for(i = 0; i < found; i++)
+  {
+    /* Read the instruction behind the cache's back so the counters stay put */
+    level = log_level;
+    if(log_level > LOG_INSTRUCTIONS)
+      log_level = LOG_INSTRUCTIONS;
+    accessDRAM(hot[i].pc, (byte*)&inst, WORD_SIZE, READ);
+    log_level = level;
+
+    format_inst(buffer, ntohl(inst), hot[i].pc + sizeof(instruction));
+    buffer[strcspn(buffer, "\n")] = '\0';
+    printf("0x%08X\t%-8llu\t%-8llu\t%-8llu\t%s\n", hot[i].pc, hot[i].accesses, hot[i].misses, hot[i].writebacks, buffer);
+  }
+
+  if(found == 0)
+    printf("No loads or stores recorded\n");
+
+  free(hot);
+}
+
+void configure_profiler(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int block;
+
+  if(strcmp(command, "off") == 0)
+  {
+    configure_reuse_profile(0);
+    printf("Reuse profiling off\n");
+    return;
+  }
+
+  if(strlen(command) == 0)
+    block = block_size != 0 ? block_size : sizeof(word);
+  else
+    block = atoi(command);
+
+  if(block < 1)
+  {
+    printf("Invalid block size\n");
+    return;
+  }
+
+  configure_reuse_profile(block);
+  printf("Profiling reuse distances at %u byte granularity\n", reuse_profile.block_bytes);
+}
+
+void configure_sharing(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int block;
+
+  if(strcmp(command, "off") == 0)
+  {
+    configure_sharing_profile(0);
+    printf("False sharing detection off\n");
+    return;
+  }
+
+  if(strlen(command) == 0)
+    block = block_size != 0 ? block_size : sizeof(word);
+  else
+    block = atoi(command);
+
+  if(block < 1 || configure_sharing_profile(block) != 0)
+  {
+    printf("Invalid block size (at most %d bytes)\n", MAX_SHARING_BLOCK);
+    return;
+  }
+  printf("Detecting false sharing at %u byte granularity\n", sharing_profile.block_bytes);
+}
+
+void configure_logging(StringTokenizer* tokenizer)
+{
+  static char* level_names[] = { "off", "summary", "inst", "dram" };
+  char* command = nextToken(tokenizer);
+  int level;
+
+  for(level = LOG_OFF; level <= LOG_DRAM; level++)
+    if(strcmp(command, level_names[level]) == 0)
+      break;
+
+  if(level > LOG_DRAM)
+  {
+    printf("Log level is '%s'; choose off, summary, inst or dram\n", level_names[log_level]);
+    return;
+  }
+
+  log_level = level;
+  printf("Log level set to '%s'\n", level_names[log_level]);
+}
+
+void configure_tracing(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int capacity = 1 << 16;
+
+  if(strcmp(command, "off") == 0)
+  {
+    configure_trace(0);
+    printf("Tracing off\n");
+    return;
+  }
+
+  if(strcmp(command, "on") != 0)
+  {
+    printf("Please specify 'on' or 'off'\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0)
+    capacity = atoi(command);
+
+  if(capacity < 1 || configure_trace(capacity) != 0)
+    printf("Unable to allocate a trace buffer of %d events\n", capacity);
+  else
+    printf("Tracing into a buffer of the last %llu events\n", (unsigned long long)(1 << uint_log2(capacity)));
+}
+
+void dump_trace(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  char buffer[300];
+  unsigned long long available = trace_available();
+  unsigned long long count = available;
+  unsigned long long i;
+  FILE* file = stdout;
+
+  if(strcmp(command, "log") != 0)
+  {
+    printf("Invalid command: dump %s\n", command);
+    return;
+  }
+
+  if(!trace_active)
+  {
+    printf("Tracing is off; use 'trace on' first\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0 && atoi(command) > 0 && atoi(command) < count)
+    count = atoi(command);
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0 && !(file = fopen(command, "w")))
+  {
+    printf("Unable to open [%s]\n", command);
+    return;
+  }
+
+  if(trace_dropped() != 0)
+    fprintf(file, "(%llu older events overwritten)\n", trace_dropped());
+
+  for(i = available - count; i < available; i++)
+  {
+    format_trace_event(buffer, i);
+    fputs(buffer, file);
+  }
+
+  if(file != stdout)
+  {
+    fclose(file);
+    printf("Wrote %llu events\n", count);
+  }
+}
+
+void configure_vm(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  unsigned int page_bytes;
+  unsigned int levels;
+  unsigned int frames_used;
+
+  if(strlen(command) != 0)
+  {
+    page_bytes = atoi(command);
+    command = nextToken(tokenizer);
+    levels = strlen(command) != 0 ? atoi(command) : 2;
+    if(configure_page_table(page_bytes, levels) != 0)
+    {
+      printf("Pages must be a power of two from 256 to %d bytes, over 1 to %d levels\n", MAX_PAGE_SIZE, MAX_PAGE_LEVELS);
+      return;
+    }
+    printf("Page table cleared; reload the program\n");
+  }
+
+  get_page_table_info(&page_bytes, &levels, &frames_used);
+  printf("%u byte pages, %u level page table, %u pages mapped (%u KB resident)\n", page_bytes, levels, frames_used, (unsigned int)((unsigned long long)frames_used * page_bytes / 1024));
+}
+
+void configure_tlb_model(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int entries;
+  int assoc;
+  int latency = 30;
+  ReplacementPolicy p;
+
+  if(strcmp(command, "off") == 0)
+  {
+    configure_tlb(0, 0, LRU, 0);
+    printf("TLB model off\n");
+    return;
+  }
+
+  entries = atoi(command);
+  command = nextToken(tokenizer);
+  assoc = atoi(command);
+
+  command = nextToken(tokenizer);
+  if(strcmp(command, "lru") == 0)
+    p = LRU;
+  else if(strcmp(command, "r") == 0)
+    p = RANDOM;
+  else if(strcmp(command, "lfu") == 0)
+    p = LFU;
+  else
+  {
+    printf("Invalid parameter for Replacement Policy\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0)
+    latency = atoi(command);
+
+  if(entries < 1 || assoc < 1 || latency < 0 || configure_tlb(entries, assoc, p, latency) != 0)
+  {
+    printf("The TLB needs 1 to %d entries, a multiple of its associativity\n", MAX_TLB_ENTRIES);
+    return;
+  }
+  printf("Modeling a %d entry, %d-way TLB with %d cycles per page table level\n", entries, assoc, latency);
+}
+
+void configure_pipeline_model(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int values[3] = { 1, 100, 2 };
+  int i;
+
+  if(strcmp(command, "off") == 0)
+  {
+    pipeline.enabled = 0;
+    printf("Pipeline timing model off\n");
+    return;
+  }
+
+  for(i = 0; i < 3 && strlen(command) != 0; i++)
+  {
+    values[i] = atoi(command);
+    command = nextToken(tokenizer);
+  }
+
+  if(sampling.enabled || set_sampling.ratio > 1)
+  {
+    printf("Turn off 'sample' and 'setsample' first, sampled-out accesses cannot be timed\n");
+    return;
+  }
+  if(values[0] < 1 || values[1] < 0 || values[2] < 0 ||
+     configure_pipeline(values[0], values[1], values[2]) != 0)
+  {
+    printf("Latencies must be positive, and a hit must take at least 1 cycle\n");
+    return;
+  }
+  printf("Timing a 5-stage pipeline: hit %d cycles, miss penalty %d, branch penalty %d\n", values[0], values[1], values[2]);
+}
+
+void configure_branch_predictor(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  PredictorKind kind;
+  int values[3] = { 4096, 256, 0 };
+  int i;
+
+  if(strcmp(command, "off") == 0)
+  {
+    predictor.enabled = 0;
+    printf("Branch prediction off\n");
+    return;
+  }
+  else if(strcmp(command, "bimodal") == 0)
+    kind = BIMODAL;
+  else if(strcmp(command, "gshare") == 0)
+    kind = GSHARE;
+  else
+  {
+    printf("Predictor is either 'bimodal' or 'gshare'\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  for(i = 0; i < 3 && strlen(command) != 0; i++)
+  {
+    values[i] = atoi(command);
+    command = nextToken(tokenizer);
+  }
+
+  if(values[2] < 0 || configure_predictor(kind, values[0], values[1], values[2]) != 0)
+  {
+    printf("Unsupported predictor (powers of 2, up to %d counters and %d BTB entries)\n", MAX_PREDICTOR_ENTRIES, MAX_BTB_ENTRIES);
+    return;
+  }
+  printf("Predicting branches with %s, %d counters, %d BTB entries\n", kind == GSHARE ? "gshare" : "bimodal", values[0], values[1]);
+}
+
+void configure_multicore(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int cores;
+  int quantum = 1000;
+
+  if(strlen(command) == 0)
+  {
+    printf("Please specify a number of cores.\n");
+    return;
+  }
+  cores = atoi(command);
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0)
+    quantum = atoi(command);
+
+  if(cores < 1 || quantum < 1 || configure_cores(cores, quantum) != 0)
+  {
+    printf("Unsupported configuration (1 to %d cores, a quantum of at least 1)\n", MAX_CORES);
+    return;
+  }
+  printf("%d cores from PC 0x%08X, switching every %d instructions\n", cores, PC, quantum);
+}
+
+void configure_coherence(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  int pointers = 0;
+
+  if(strcmp(command, "snoop") == 0)
+  {
+    configure_directory(0, 0);
+    printf("Caches kept coherent by snooping\n");
+    return;
+  }
+  else if(strcmp(command, "directory") != 0)
+  {
+    printf("Coherence is either 'snoop' or 'directory'\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0)
+    pointers = atoi(command);
+
+  if(pointers < 0 || configure_directory(1, pointers) != 0)
+  {
+    printf("A directory entry holds up to %d pointers\n", MAX_CORES);
+    return;
+  }
+  if(pointers == 0)
+    printf("Caches kept coherent by a full bit vector directory\n");
+  else
+    printf("Caches kept coherent by a directory of %d pointers per entry\n", pointers);
 }
 
-void display_regs()
+void configure_partitioning(StringTokenizer* tokenizer)
 {
-  static char* register_display[] = { 
-    "R00: %08x\tR08: %08x\tR16: %08x\tR24: %08x\n",
-    "R01: %08x\tR09: %08x\tR17: %08x\tR25: %08x\n",
-    "R02: %08x\tR10: %08x\tR18: %08x\tR26: %08x\n",
-    "R03: %08x\tR11: %08x\tR19: %08x\tR27: %08x\n",
-    "R04: %08x\tR12: %08x\tR20: %08x\tR28: %08x\n",
-    "R05: %08x\tR13: %08x\tR21: %08x\tR29: %08x\n",
-    "R06: %08x\tR14: %08x\tR22: %08x\tR30: %08x\n",
-    "R07: %08x\tR15: %08x\tR23: %08x\tR31: %08x\n",
-    " PC: %08x\n"
-  };
+  char* command = nextToken(tokenizer);
+  unsigned int masks[MAX_CORES];
+  unsigned int interval = 10000;
+  int count = 0;
 
-  int i;
+  if(strcmp(command, "off") == 0)
+  {
+    configure_partitions(PARTITION_OFF, NULL, 0);
+    printf("Cores back on private caches\n");
+    return;
+  }
+  else if(strcmp(command, "ucp") == 0)
+  {
+    command = nextToken(tokenizer);
+    if(strlen(command) != 0)
+      interval = atoi(command);
+    if(configure_partitions(PARTITION_UCP, NULL, interval) != 0)
+    {
+      printf("UCP needs an interval and at least a way per core\n");
+      return;
+    }
+    printf("Cores share the cache, repartitioned by UCP every %u accesses\n", interval);
+    return;
+  }
 
-  printf("\n");
-  for(i = 0; i < 8; i++)
-    printf(register_display[i], registers[i], registers[i + 8], registers[i + 16], registers[i+24]);
+  memset(masks, 0, sizeof(masks));
+  for(; strlen(command) != 0 && count < MAX_CORES; command = nextToken(tokenizer))
+    masks[count++] = strtoul(command, NULL, 0);
 
-  /* Display PC */
-  printf(register_display[i], PC);
-  printf("\n");
+  if(count == 0)
+  {
+    printf("Partition with way masks, 'ucp' or 'off'\n");
+    return;
+  }
+
+  configure_partitions(PARTITION_STATIC, masks, 0);
+  printf("Cores share the cache, filling the ways of %d masks\n", count);
 }
 
-void display_cache()
+void configure_dram_model(StringTokenizer* tokenizer)
 {
-  int s;
-  int b;
-  int o;
+  char* command = nextToken(tokenizer);
+  int values[6];
+  int closed_page = 0;
+  int queue_depth = 16;
+  int i;
 
-  /* Setup cache view */
-  printf("\n");
-  
-  if(assoc == 0 || set_count == 0 || block_size == 0)
+  if(strcmp(command, "off") == 0)
   {
-    printf("Some cache parameters are set to 0\n  + Assoc: %u\n  + Set Count: %u\n  + Block Size: %u\n\n", assoc, set_count, block_size);
+    dram_stats.enabled = 0;
+    printf("DRAM timing model off\n");
     return;
   }
 
-  switch(view)
+  for(i = 0; i < 6; i++)
   {
-  case INDEX:
-    printf("Set V D  LRU\tLFU\tTag\n=== = =  ===\t===\t===\n");
-    for(b = 0; b < set_count; b++)
+    if(strlen(command) == 0)
     {
-      for(s = 0; s < assoc; s++)
-      {
-	printf("%2d  %d %d  %s\t%s\t%08x    ", b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
-	for(o = 0; o < block_size; o++)
-	{
-	  printf("%02x", cache[b].block[s].data[o]);
-
-	  if((o + 1) != block_size)
-	  {
-	    if((o + 1) % 4 == 0)
-	      printf(" | ");
-	    else if((o + 1) % 2 == 0)
-	      printf(" ");
-	  }
-	}
-	printf("\n");
-      }
-      printf("\n");
+      printf("Insufficient arguments\n");
+      return;
     }
-    break;
-  case ASSOC:
-    for(s = 0; s < assoc; s++)
-    {
-      printf("Unit #%u\n\nBlk V D  LRU\tLFU\tTag\n=== = =  ===\t===\t===\n", s);
+    values[i] = atoi(command);
+    command = nextToken(tokenizer);
+  }
 
-      for(b = 0; b < set_count; b++)
-      {
-	printf("%2d  %d %d  %s\t%s\t%08x    ", b, cache[b].block[s].valid, cache[b].block[s].dirty, lru_to_string(b, s), lfu_to_string(b, s), cache[b].block[s].tag);
-	for(o = 0; o < block_size; o++)
-	{
-	  printf("%02x", cache[b].block[s].data[o]);
+  if(strcmp(command, "closed") == 0)
+    closed_page = 1;
+  else if(strlen(command) != 0 && strcmp(command, "open") != 0)
+  {
+    printf("Page policy is either 'open' or 'closed'\n");
+    return;
+  }
 
-	  if((o + 1) != block_size)
-	  {
-	    if((o + 1) % 4 == 0)
-	      printf(" | ");
-	    else if((o + 1) % 2 == 0)
-	      printf(" ");
-	  }
-	}
-	printf("\n");
-	if((b + 1) % 4 == 0)
-	  printf("\n");
-      }
-    }
-    break;
-  default:
-    printf("Invalid cache arrangement");
-    exit(1);
+  command = nextToken(tokenizer);
+  if(strlen(command) != 0)
+    queue_depth = atoi(command);
+
+  for(i = 0; i < 6; i++)
+    if(values[i] < 0)
+      break;
+
+  if(i < 6 || queue_depth < 1 ||
+     configure_dram(values[0], values[1], values[2], values[3], values[4], values[5], closed_page, queue_depth) != 0)
+  {
+    printf("Unsupported DRAM organization (up to %d channels, %d banks, a queue of %d)\n", MAX_DRAM_CHANNELS, MAX_DRAM_BANKS, MAX_DRAM_QUEUE);
+    return;
+  }
+  printf("Modeling DRAM timing\n");
+}
+
+void run_checkpoint(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  char filename[200];
+  int save = strcmp(command, "save") == 0;
+  int error;
+
+  if(!save && strcmp(command, "load") != 0)
+  {
+    printf("Please specify 'save' or 'load'\n");
+    return;
+  }
+
+  command = nextToken(tokenizer);
+  if(strlen(command) == 0 || strlen(command) >= sizeof(filename))
+  {
+    printf("Please specify a file name\n");
+    return;
+  }
+  strcpy(filename, command);
+
+  if(save)
+  {
+    command = nextToken(tokenizer);
+    error = save_checkpoint(filename, strcmp(command, "cache") == 0);
+  }
+  else
+    error = load_checkpoint(filename);
+
+  if(error == -2)
+    printf("Checkpoints hold a single core, use 'cores 1' and 'partition off' first\n");
+  else if(save && error != 0)
+    printf("Unable to write [%s]\n", filename);
+  else if(save)
+    printf("Checkpoint saved to [%s]\n", filename);
+  else if(error != 0)
+    printf("[%s] is not a usable checkpoint\n", filename);
+  else
+    printf("Checkpoint restored, PC is 0x%08X\n", PC);
+}
+
+void configure_fetching(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+
+  if(strcmp(command, "batch") == 0)
+    batch_fetches = 1;
+  else if(strcmp(command, "exact") == 0)
+    batch_fetches = 0;
+  else
+  {
+    printf("Please specify 'batch' or 'exact'\n");
+    return;
+  }
+
+  printf("Instruction fetches are %s\n", batch_fetches ? "issued a basic block at a time" : "interleaved with data accesses");
+}
+
+void configure_sampler(StringTokenizer* tokenizer)
+{
+  char* command = nextToken(tokenizer);
+  unsigned int period;
+  unsigned int warmup;
+  unsigned int window;
+
+  if(strcmp(command, "off") == 0)
+  {
+    configure_sampling(0, 0, 0);
+    printf("Sampling off\n");
+    return;
+  }
+
+  if(strlen(command) == 0)
+  {
+    printf("Insufficient arguments\n");
+    return;
+  }
+  period = atoi(command);
+
+  command = nextToken(tokenizer);
+  if(strlen(command) == 0)
+  {
+    printf("Insufficient arguments\n");
+    return;
   }
+  warmup = atoi(command);
 
+  command = nextToken(tokenizer);
+  if(strlen(command) == 0)
+  {
+    printf("Insufficient arguments\n");
+    return;
+  }
+  window = atoi(command);
+
+  if(period != 0 && pipeline.enabled)
+    printf("Turn off 'pipeline' first, it cannot time warmed accesses\n");
+  else if(configure_sampling(period, warmup, window) != 0)
+    printf("Warmup and window must fit in the period\n");
+  else
+    printf("Sampling %u of every %u accesses after %u warmup accesses\n", window, period, warmup);
 }
 
 void display_help()
@@ -169,7 +1240,8 @@ void display_help()
   printf("\n");
   printf("quit -- Exit the simulator\n");
   printf("\n");
-  printf("load <file> -- Load <file> of binary machine code into memory\n");
+  printf("load <file> -- Load <file> of binary machine code into memory, either\n");
+  printf("  a raw dump or a big-endian MIPS ELF32 executable\n");
   printf("\n");
   printf("config <set_count> <assoc> <block_size> <Replacement Policy> <Sync Policy> --\n");
   printf("  Set cache to have <set_count> sets (i.e. number of unique indexes), <assoc>\n");
@@ -182,17 +1254,125 @@ void display_help()
   printf("\n");
   printf("step N -- Step the program for N instructions\n");
   printf("\n");
+  printf("log <level> -- Choose what is printed while running: 'off', 'summary'\n");
+  printf("  for loads and memory errors, 'inst' to add every instruction, or\n");
+  printf("  'dram' to add every DRAM transfer (the default)\n");
+  printf("\n");
+  printf("vm [page_bytes] [levels] -- Show the page table, or rebuild it empty with\n");
+  printf("  pages of page_bytes over levels (2 by default); reload the program after\n");
+  printf("\n");
+  printf("tlb <entries> <assoc> <Replacement Policy> [cycles] -- Model a TLB in front\n");
+  printf("  of the page table, each miss costing cycles (30 by default) per level.\n");
+  printf("  Its counters are shown by 'print stats'; 'tlb off' removes it\n");
+  printf("\n");
+  printf("dram <channels> <banks> <row_bytes> <tRCD> <tCAS> <tRP> [open|closed] [queue]\n");
+  printf("  -- Time DRAM transfers with banks, row buffers and an FR-FCFS queue of\n");
+  printf("  [queue] requests per channel (16 by default). 'print stats' shows the\n");
+  printf("  row buffer hit rate and latencies; 'dram off' stops timing\n");
+  printf("\n");
+  printf("pipeline [hit] [miss] [branch] -- Time a 5-stage in-order pipeline with\n");
+  printf("  forwarding: cache hits take [hit] cycles (1), misses and writebacks add\n");
+  printf("  [miss] (100) and taken branches lose [branch] (2). 'print stats' shows\n");
+  printf("  the CPI breakdown; 'pipeline off' stops timing. Not available with\n");
+  printf("  'sample' or 'setsample', whose skipped accesses cannot be timed\n");
+  printf("\n");
+  printf("predict bimodal|gshare [counters] [btb] [wrong] -- Predict branches with\n");
+  printf("  [counters] 2-bit counters (4096) and a [btb] entry BTB (256), fetching\n");
+  printf("  [wrong] instructions (0) down mispredicted paths into the I-cache. With\n");
+  printf("  'pipeline' only mispredictions cost cycles; 'predict off' turns it off\n");
+  printf("\n");
+  printf("cores <N> [quantum] -- Run N cores from the current PC, switching every\n");
+  printf("  [quantum] instructions (1000). Each has its registers, a stack below the\n");
+  printf("  previous core's, its number in $k0 and a private cache kept coherent by\n");
+  printf("  snooping MESI. 'print regs' shows the running core\n");
+  printf("\n");
+  printf("coherence snoop|directory [pointers] -- Keep the caches coherent by\n");
+  printf("  snooping (the default) or with a directory whose entries name [pointers]\n");
+  printf("  sharers, or every core with a full bit vector (0, the default), and\n");
+  printf("  broadcast invalidations once the pointers overflow\n");
+  printf("\n");
+  printf("sharing <block_size> -- Detect true and false sharing between cores at\n");
+  printf("  <block_size> bytes, the cache block size by default. 'sharing off'\n");
+  printf("  stops detecting\n");
+  printf("\n");
+  printf("print sharing N -- Print the N blocks whose writes invalidated the most\n");
+  printf("  copies, with the cores and store PCs that wrote them\n");
+  printf("\n");
+  printf("partition <mask> [mask...] | ucp [interval] | off -- Let the cores share\n");
+  printf("  one cache, each filling on a miss only the ways of its mask (0x3 for\n");
+  printf("  ways 0 and 1), or with 'ucp' partitions resized every [interval]\n");
+  printf("  accesses (10000) from shadow tag utility monitors. 'print stats' shows\n");
+  printf("  each core's hit rate. 'partition off' brings back private caches\n");
+  printf("\n");
+  printf("checkpoint save <file> [cache] -- Save registers, PC and memory, and with\n");
+  printf("  'cache' the cache contents and replacement state, to <file>. Only a\n");
+  printf("  single core without cache partitioning can be saved or restored\n");
+  printf("\n");
+  printf("checkpoint load <file> -- Restore a saved checkpoint and clear statistics\n");
+  printf("\n");
+  printf("fetch batch|exact -- Let 'step' hand the fetches of a whole basic block\n");
+  printf("  to the cache ahead of its loads and stores, which is faster, or keep\n");
+  printf("  them interleaved (the default)\n");
+  printf("\n");
+  printf("trace on [N] -- Record fetches, cache accesses and DRAM transfers as\n");
+  printf("  binary events in a ring buffer of the last N (65536 by default).\n");
+  printf("  'trace off' stops and discards the trace\n");
+  printf("\n");
+  printf("dump log [N] [file] -- Decode the last N trace events, all by default,\n");
+  printf("  to the screen or to [file]\n");
+  printf("\n");
   printf("run <time>-- Start automated simulation with instructions executing\n");
   printf("  every <time> milliseconds. Press Ctrl-C to stop the simulation\n");
   printf("\n");
+  printf("run max [N] -- Run at full speed until the sentinel, N instructions or\n");
+  printf("  Ctrl-C, then print instructions and accesses per second\n");
+  printf("\n");
+  printf("ffwd <N> [W] -- Execute N instructions at full speed, bypassing the\n");
+  printf("  cache and memory models, then W that only warm the cache, and clear\n");
+  printf("  the statistics so detailed simulation starts there\n");
+  printf("\n");
+  printf("ffwd-until <PC> [W] -- Same as ffwd, up to the instruction at PC\n");
+  printf("\n");
   printf("print regs -- Print all MIPS registers\n");
   printf("\n");
   printf("print cache -- Print the current cache state\n");
   printf("\n");
+  printf("print stats -- Print hit, miss and writeback counts\n");
+  printf("\n");
+  printf("sample <period> <warmup> <window> -- Simulate only the last <window> of\n");
+  printf("  every <period> accesses in detail, after <warmup> unmeasured detailed\n");
+  printf("  accesses. The rest only warm the cache. 'sample off' turns it off\n");
+  printf("\n");
+  printf("print sample -- Print the sampled miss rate and its confidence interval\n");
+  printf("\n");
+  printf("setsample <N> [check] -- Simulate only 1 in <N> cache sets, picked by\n");
+  printf("  a hash of their index, and scale the counters back up. With 'check'\n");
+  printf("  every set is still simulated, so 'print setsample' can compare the\n");
+  printf("  estimate with the real counts. 'setsample off' simulates every set again\n");
+  printf("\n");
+  printf("print setsample -- Print the set sampling estimates\n");
+  printf("\n");
+  printf("profile <block_size> -- Profile reuse distances of every access at\n");
+  printf("  <block_size> bytes, the cache block size by default. 'profile off'\n");
+  printf("  stops profiling\n");
+  printf("\n");
+  printf("print reuse -- Print the stack and time reuse distance histograms\n");
+  printf("\n");
+  printf("print hotpcs N -- Print the N loads and stores with the most misses\n");
+  printf("\n");
+  printf("print heatmap -- Print per-set counters and a heatmap of misses\n");
+  printf("\n");
+  printf("print evictions N -- Print the N most frequent tag-evicts-tag pairs\n");
+  printf("\n");
+  printf("export <sets|evictions> <file> -- Write per-set counters or the\n");
+  printf("  eviction-cause matrix to <file> as CSV\n");
+  printf("\n");
   printf("reset cpu -- Reset the PC and $sp back to startup values\n");
   printf("\n");
   printf("reset cache -- Flush the cache\n");
   printf("\n");
+  printf("reset stats -- Clear the hit, miss and sampling counters\n");
+  printf("\n");
   printf("reinit -- does \"reset cpu\" and \"reset cache\" commands\n");
   printf("\n");
   printf("help -- List top-level commands\n");
@@ -290,7 +1470,6 @@ void configure_cache(StringTokenizer* tokenizer)
 void do_step(StringTokenizer* tokenizer)
 {
   char* command = nextToken(tokenizer);
-  int i;
   int n;
 
   if(strlen(command) == 0)
@@ -300,8 +1479,101 @@ void do_step(StringTokenizer* tokenizer)
   if(n <= 0)
     n = 1;
 
-  for(i = 0; i < n; i++)
-    step_processor();
+  run_processor(n);
+}
+
+/*
+  Runs the program without pausing until the sentinel, until limit
+  instructions have executed (no limit if 0), until PC reaches *until (if
+  not NULL) or until Ctrl-C, which is only checked every RUN_CHECK_INTERVAL
+  instructions. Prints the simulation speed at the end.
+
+  returns 0 if interrupted by Ctrl-C, 1 otherwise
+ */
+int run_to_completion(unsigned long long limit, const address* until)
+{
+  unsigned long long executed = 0;
+  unsigned long long accesses = cache_stats.accesses;
+  unsigned long long chunk, ran;
+  clock_t start;
+  double seconds;
+  int completed;
+
+  run_active = 1;
+  start = clock();
+  while(run_active && (limit == 0 || executed < limit))
+  {
+    chunk = RUN_CHECK_INTERVAL;
+    if(limit != 0 && limit - executed < chunk)
+      chunk = limit - executed;
+
+    ran = (until != NULL ? run_until(*until, chunk) : run_processor(chunk));
+    executed += ran;
+    if(ran < chunk)
+      break;
+  }
+  seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+  accesses = cache_stats.accesses - accesses;
+
+  completed = run_active;
+  if(!completed)
+    printf("Interrupted, ");
+  run_active = 0;
+
+  printf("Ran %llu instructions in %.3f seconds, PC is now 0x%08X\n", executed, seconds, PC);
+  if(seconds > 0)
+    printf("%.0f instructions/sec, %.0f accesses/sec\n", executed / seconds, accesses / seconds);
+
+  return completed;
+}
+
+/*
+  ffwd <N> [warmup] / ffwd-until <PC> [warmup]: executes N instructions, or
+  up to PC, with every memory model bypassed, then warmup more instructions
+  that only warm the cache, and clears the statistics so that detailed
+  accounting starts from there.
+ */
+void fast_forward(StringTokenizer* tokenizer, int until)
+{
+  char* command = nextToken(tokenizer);
+  LogLevel level = log_level;
+  unsigned long long count = 0;
+  unsigned long long warmup;
+  address target = 0;
+
+  if(strlen(command) == 0)
+  {
+    printf("Usage: %s\n", until ? "ffwd-until <PC> [warmup]" : "ffwd <N> [warmup]");
+    return;
+  }
+
+  if(until)
+    target = strtoul(command, NULL, 0);
+  else if((count = strtoull(command, NULL, 0)) == 0)
+  {
+    printf("Invalid instruction count: %s\n", command);
+    return;
+  }
+  warmup = strtoull(nextToken(tokenizer), NULL, 0);
+
+  /* Nothing is simulated, so per-instruction logs would only slow it down */
+  if(log_level > LOG_SUMMARY)
+    log_level = LOG_SUMMARY;
+
+  printf("Fast-forwarding\n");
+  set_simulation_mode(FUNCTIONAL);
+  if(run_to_completion(count, until ? &target : NULL) && warmup != 0)
+  {
+    printf("Warming up\n");
+    set_simulation_mode(WARMING);
+    run_to_completion(warmup, NULL);
+  }
+  set_simulation_mode(DETAILED);
+  log_level = level;
+
+  reset_cache_stats();
+  configure_sampling(sampling.period, sampling.warmup, sampling.window);
+  printf("Detailed simulation starts at PC 0x%08X, statistics cleared\n", PC);
 }
 
 void start_simulation(StringTokenizer* tokenizer)
@@ -314,14 +1586,26 @@ void start_simulation(StringTokenizer* tokenizer)
     return;
   }
 
+  if(strcmp(command, "max") == 0)
+  {
+    command = nextToken(tokenizer);
+    run_to_completion(strtoull(command, NULL, 0), NULL);
+    return;
+  }
+
   speed = atoi(command);
-  if(speed < 1)
+  if(speed < MIN_SPEED)
     speed = MIN_SPEED;
   else if(speed > MAX_SPEED)
     speed = MAX_SPEED;
 
   /* Begin execution */
-
+  run_active = 1;
+  while(run_active)
+  {
+    step_processor();
+    usleep(1000 * speed);
+  }
 }
 
 void activate_no_gui(int argc, char** argv)
@@ -330,17 +1614,33 @@ void activate_no_gui(int argc, char** argv)
   StringTokenizer* tokenizer;
   char input[200];
   char* command;
-  int speed;
 
   (void)signal(SIGINT, catch);
   run_active = 0;
   
   printf("Tips v2 Started\n");
 
+  /* Batch mode only logs summaries, per-instruction output would dominate */
+  if(strcmp(argv[1], "-batch") == 0)
+    log_level = LOG_SUMMARY;
+
   /* Load file if any */
   if(argc >= 3)
     load_dumpfile(argv[argc - 1]);
 
+  /* In batch mode run it to completion, print the statistics and exit */
+  if(strcmp(argv[1], "-batch") == 0)
+  {
+    if(argc >= 3)
+    {
+      run_to_completion(argc >= 4 ? strtoull(argv[2], NULL, 0) : 0, NULL);
+      display_stats();
+    }
+    else
+      printf("Usage: %s -batch [limit] <file>\n", program_name);
+    return;
+  }
+
   while(console_active)
   {
     printf("\n[%s] > ", program_name);
@@ -361,11 +1661,63 @@ void activate_no_gui(int argc, char** argv)
 	display_regs();
       else if(strcmp(command, "cache") == 0)
 	display_cache();
+      else if(strcmp(command, "stats") == 0)
+	display_stats();
+      else if(strcmp(command, "sample") == 0)
+	display_sampling();
+      else if(strcmp(command, "setsample") == 0)
+	display_set_sampling();
+      else if(strcmp(command, "reuse") == 0)
+	display_reuse_profile();
+      else if(strcmp(command, "hotpcs") == 0)
+	display_hot_pcs(tokenizer);
+      else if(strcmp(command, "heatmap") == 0)
+	display_heatmap();
+      else if(strcmp(command, "evictions") == 0)
+	display_evictions(tokenizer);
+      else if(strcmp(command, "sharing") == 0)
+	display_sharing(tokenizer);
       else
 	printf("Invalid command: %s\n", input);
     }
     else if(strcmp(command, "config") == 0)
       configure_cache(tokenizer);
+    else if(strcmp(command, "sample") == 0)
+      configure_sampler(tokenizer);
+    else if(strcmp(command, "setsample") == 0)
+      configure_set_sampler(tokenizer);
+    else if(strcmp(command, "profile") == 0)
+      configure_profiler(tokenizer);
+    else if(strcmp(command, "export") == 0)
+      export_statistics(tokenizer);
+    else if(strcmp(command, "log") == 0)
+      configure_logging(tokenizer);
+    else if(strcmp(command, "vm") == 0)
+      configure_vm(tokenizer);
+    else if(strcmp(command, "tlb") == 0)
+      configure_tlb_model(tokenizer);
+    else if(strcmp(command, "pipeline") == 0)
+      configure_pipeline_model(tokenizer);
+    else if(strcmp(command, "predict") == 0)
+      configure_branch_predictor(tokenizer);
+    else if(strcmp(command, "cores") == 0)
+      configure_multicore(tokenizer);
+    else if(strcmp(command, "coherence") == 0)
+      configure_coherence(tokenizer);
+    else if(strcmp(command, "sharing") == 0)
+      configure_sharing(tokenizer);
+    else if(strcmp(command, "partition") == 0)
+      configure_partitioning(tokenizer);
+    else if(strcmp(command, "dram") == 0)
+      configure_dram_model(tokenizer);
+    else if(strcmp(command, "checkpoint") == 0)
+      run_checkpoint(tokenizer);
+    else if(strcmp(command, "fetch") == 0)
+      configure_fetching(tokenizer);
+    else if(strcmp(command, "trace") == 0)
+      configure_tracing(tokenizer);
+    else if(strcmp(command, "dump") == 0)
+      dump_trace(tokenizer);
     else if(strcmp(command, "view") == 0)
     {
       command = nextToken(tokenizer);
@@ -392,18 +1744,11 @@ void activate_no_gui(int argc, char** argv)
     else if(strcmp(command, "step") == 0)
       do_step(tokenizer);
     else if(strcmp(command, "run") == 0)
-    {
-      command = nextToken(tokenizer);
-      speed = atoi(command);
-      if(speed < 10)
-	speed = 10;
-      run_active = 1;
-      while(run_active)
-      {
-	step_processor();
-	usleep(1000 * speed);
-      }
-    }
+      start_simulation(tokenizer);
+    else if(strcmp(command, "ffwd") == 0)
+      fast_forward(tokenizer, 0);
+    else if(strcmp(command, "ffwd-until") == 0)
+      fast_forward(tokenizer, 1);
     else if(strcmp(command, "reinit") == 0)
     {
       reinit_processor();
@@ -424,6 +1769,12 @@ void activate_no_gui(int argc, char** argv)
 	flush_cache();
 	printf("\nCache flushed\n");
       }
+      else if(strcmp(command, "stats") == 0)
+      {
+	reset_cache_stats();
+	configure_sampling(sampling.period, sampling.warmup, sampling.window);
+	printf("\nStatistics cleared\n");
+      }
       else
 	printf("Invalid command: %s\n", input);
     }
@@ -1,10 +1,15 @@
 #include "tips.h"
 #include "util.h"
 #include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 char* program_name;
 CacheView view;
 int gui_active;
+LogLevel log_level = LOG_DRAM;
 
 void validate_cache_parameters(int set_count_value, int assoc_value, int block_size_value)
 {
@@ -38,40 +43,315 @@ void validate_cache_parameters(int set_count_value, int assoc_value, int block_s
     block_size = 0;
 }
 
-int load_dumpfile(const char* filename)
+/* ELF32 fields used by load_elf(), as byte offsets */
+#define ELF_CLASS 4
+#define ELF_DATA 5
+#define ELF_MACHINE 18
+#define ELF_ENTRY 24
+#define ELF_PHOFF 28
+#define ELF_SHOFF 32
+#define ELF_PHENTSIZE 42
+#define ELF_PHNUM 44
+#define ELF_SHENTSIZE 46
+#define ELF_SHNUM 48
+#define ELF_HEADER_SIZE 52
+#define PHDR_TYPE 0
+#define PHDR_OFFSET 4
+#define PHDR_VADDR 8
+#define PHDR_FILESZ 16
+#define PHDR_MEMSZ 20
+#define PHDR_FLAGS 24
+#define PHDR_SIZE 32
+#define SHDR_TYPE 4
+#define SHDR_FLAGS 8
+#define SHDR_ADDR 12
+#define SHDR_SIZE 20
+#define SHDR_ENTRY_SIZE 40
+#define PT_LOAD 1
+#define PF_X 1
+#define SHT_NOBITS 8
+#define SHF_ALLOC 2
+#define SHF_EXECINSTR 4
+#define EM_MIPS 8
+
+static word read_be32(const byte* p)
+{
+  return ((word)p[0] << 24) | ((word)p[1] << 16) | ((word)p[2] << 8) | p[3];
+}
+
+static unsigned int read_be16(const byte* p)
+{
+  return (p[0] << 8) | p[1];
+}
+
+/* copies size bytes of src to addr, a page at a time, and zeroes the rest
+   of memsz; words are swapped to host order if swap is set */
+static int load_segment(address addr, const byte* src, unsigned int size, unsigned int memsz, int swap)
+{
+  byte* memory;
+  unsigned int bytes;
+  unsigned int chunk;
+  unsigned int done;
+
+  for(done = 0; done < memsz; done += chunk, addr += chunk)
+  {
+    if(!(memory = mapDRAM(addr, &bytes)))
+      return -1;
+    chunk = bytes < memsz - done ? bytes : memsz - done;
+
+    if(done >= size)
+      memset(memory, 0, chunk);
+    else if(chunk > size - done)
+    {
+      /* The end of the file data falls in this page */
+      memset(memory, 0, chunk);
+      memcpy(memory, src + done, size - done);
+      if(swap)
+        reverse_words((word*) memory, (const word*) memory, (size - done + 3) / sizeof(word));
+    }
+    else if(swap)
+      reverse_words((word*) memory, (const word*) (src + done), chunk / sizeof(word));
+    else
+      memcpy(memory, src + done, chunk);
+  }
+
+  return 0;
+}
+
+/* swaps the words of size bytes from addr, rounded out to whole words, in
+   place */
+static int swap_loaded_words(address addr, unsigned int size)
+{
+  byte* memory;
+  unsigned int bytes;
+  unsigned int chunk;
+  address end = (addr + size + 3) & ~3;
+
+  for(addr &= ~3; addr < end; addr += chunk)
+  {
+    if(!(memory = mapDRAM(addr, &bytes)))
+      return -1;
+    chunk = bytes < end - addr ? bytes : end - addr;
+    reverse_words((word*) memory, (const word*) memory, chunk / sizeof(word));
+  }
+  return 0;
+}
+
+/*
+  Swaps the words of the allocated sections that hold data, such as
+  .rodata, but were loaded verbatim as part of an executable segment.
+
+  returns the number of such sections, or -1 if the section headers are
+  missing or malformed
+ */
+static int swap_data_in_text(const byte* image, unsigned int size)
+{
+  const byte* shdr;
+  const byte* phdr;
+  unsigned int count = read_be16(image + ELF_SHNUM);
+  unsigned int entry_size = read_be16(image + ELF_SHENTSIZE);
+  unsigned int offset = read_be32(image + ELF_SHOFF);
+  unsigned int segments = read_be16(image + ELF_PHNUM);
+  address swapped_end = 0;
+  address addr;
+  int found = 0;
+  unsigned int i;
+  unsigned int j;
+
+  if(count == 0 || entry_size < SHDR_ENTRY_SIZE || offset > size || count > (size - offset) / entry_size)
+    return -1;
+
+  for(i = 0; i < count; i++)
+  {
+    shdr = image + offset + i * entry_size;
+    addr = read_be32(shdr + SHDR_ADDR);
+    if(!(read_be32(shdr + SHDR_FLAGS) & SHF_ALLOC) || (read_be32(shdr + SHDR_FLAGS) & SHF_EXECINSTR) ||
+       read_be32(shdr + SHDR_TYPE) == SHT_NOBITS || read_be32(shdr + SHDR_SIZE) == 0)
+      continue;
+
+    /* Only sections inside executable segments were left unswapped */
+    for(j = 0; j < segments; j++)
+    {
+      phdr = image + read_be32(image + ELF_PHOFF) + j * read_be16(image + ELF_PHENTSIZE);
+      if(read_be32(phdr + PHDR_TYPE) == PT_LOAD && (read_be32(phdr + PHDR_FLAGS) & PF_X) &&
+         addr >= read_be32(phdr + PHDR_VADDR) && addr - read_be32(phdr + PHDR_VADDR) < read_be32(phdr + PHDR_FILESZ))
+        break;
+    }
+    if(j == segments)
+      continue;
+
+    /* Sections sharing a word must not swap it twice */
+    if((addr & ~3) < swapped_end)
+    {
+      if(addr + read_be32(shdr + SHDR_SIZE) <= swapped_end)
+        continue;
+      addr = swapped_end;
+    }
+    if(swap_loaded_words(addr, read_be32(shdr + SHDR_SIZE) - (addr - read_be32(shdr + SHDR_ADDR))) != 0)
+      return -1;
+    swapped_end = (read_be32(shdr + SHDR_ADDR) + read_be32(shdr + SHDR_SIZE) + 3) & ~3;
+    found++;
+  }
+
+  return found;
+}
+
+/*
+  Loads every PT_LOAD segment of a big-endian MIPS ELF32 executable and
+  starts the processor at its entry point. Memory keeps instructions in
+  big-endian order, as fetched, but loads and stores move words in host
+  order, so segments that are not executable get their words swapped, and
+  so do data sections the linker placed in an executable segment. Without
+  section headers there is no telling data from code there, and such data
+  reads back byte-swapped; the load message says so.
+
+  returns 0 if successful, -1 if the image is not supported
+ */
+static int load_elf(const byte* image, unsigned int size, const char* filename)
 {
   char buffer[200];
-  FILE* dumpfile;
-  int i;
-  byte* inst = (byte*)(malloc(sizeof(byte) * sizeof(instruction)));
+  const byte* phdr;
+  unsigned int count;
+  unsigned int entry_size;
+  unsigned int offset;
+  unsigned int filesz;
+  unsigned int memsz;
+  unsigned int segments = 0;
+  int executable = 0;
+  int data_in_text;
+  unsigned int i;
 
-  /* Read in file */
-  if(!(dumpfile = fopen(filename, "rb")))
+  if(size < ELF_HEADER_SIZE || image[ELF_CLASS] != 1 || image[ELF_DATA] != 2 ||
+     read_be16(image + ELF_MACHINE) != EM_MIPS)
   {
-    sprintf(buffer, "Unable to load [%s]\n", filename);
-    append_log(buffer);
+    if(LOG_ENABLED(LOG_SUMMARY))
+    {
+      sprintf(buffer, "[%s] is not a big-endian MIPS ELF32 file\n", filename);
+      append_log(buffer);
+    }
     return -1;
   }
-  else
+
+  count = read_be16(image + ELF_PHNUM);
+  entry_size = read_be16(image + ELF_PHENTSIZE);
+  offset = read_be32(image + ELF_PHOFF);
+  if(entry_size < PHDR_SIZE || offset > size || count > (size - offset) / entry_size)
+    return -1;
+
+  for(i = 0; i < count; i++)
+  {
+    phdr = image + offset + i * entry_size;
+    if(read_be32(phdr + PHDR_TYPE) != PT_LOAD)
+      continue;
+
+    filesz = read_be32(phdr + PHDR_FILESZ);
+    memsz = read_be32(phdr + PHDR_MEMSZ);
+    if(read_be32(phdr + PHDR_OFFSET) > size || filesz > size - read_be32(phdr + PHDR_OFFSET) || filesz > memsz)
+      return -1;
+
+    if(load_segment(read_be32(phdr + PHDR_VADDR), image + read_be32(phdr + PHDR_OFFSET), filesz, memsz,
+                    !(read_be32(phdr + PHDR_FLAGS) & PF_X)) != 0)
+    {
+      if(LOG_ENABLED(LOG_SUMMARY))
+        append_log("Program does not fit in memory\n");
+      return -1;
+    }
+    if(read_be32(phdr + PHDR_FLAGS) & PF_X)
+      executable = 1;
+    segments++;
+  }
+
+  data_in_text = (executable ? swap_data_in_text(image, size) : 0);
+
+  entry_point = read_be32(image + ELF_ENTRY);
+  if(LOG_ENABLED(LOG_SUMMARY))
   {
-    sprintf(buffer, "[%s] loaded\n", filename);
+    sprintf(buffer, "[%s] loaded, %u segments, entry 0x%08X\n", filename, segments, entry_point);
     append_log(buffer);
+    if(data_in_text > 0)
+    {
+      sprintf(buffer, "%d data sections in executable segments swapped to data order\n", data_in_text);
+      append_log(buffer);
+    }
+    else if(data_in_text < 0)
+      append_log("No section headers: executable segments are loaded as code only, any data in them reads byte-swapped\n");
   }
+  return 0;
+}
 
-  /* Load instructions into memory */
-  for(i = 0; i < PHYSICAL_PAGE_SIZE && fread(inst, sizeof(instruction), 1, dumpfile); i += sizeof(instruction))
+int load_dumpfile(const char* filename)
+{
+  char buffer[200];
+  struct stat status;
+  const word* text = NULL;
+  word* memory;
+  word sentinel = 0xffffffff;
+  unsigned int words;
+  unsigned int bytes;
+  unsigned int chunk;
+  unsigned int i;
+  int fd;
+
+  /* Map file */
+  if((fd = open(filename, O_RDONLY)) == -1 || fstat(fd, &status) == -1 ||
+     (status.st_size >= sizeof(word) &&
+      (text = (const word*) mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED))
   {
-    /* sprintf(buffer, "%02x , %08x\n", *inst, ntohl(*((word*)inst))); */
-    reverse_endianness( (instruction*) inst );
-    accessDRAM(PROGRAM_START + i, inst, WORD_SIZE, WRITE);
-  }  
-  
+    if(fd != -1)
+      close(fd);
+    if(LOG_ENABLED(LOG_SUMMARY))
+    {
+      sprintf(buffer, "Unable to load [%s]\n", filename);
+      append_log(buffer);
+    }
+    return -1;
+  }
+
+  /* ELF executables carry their own layout */
+  if(status.st_size >= 4 && memcmp(text, "\177ELF", 4) == 0)
+  {
+    int error = load_elf((const byte*) text, status.st_size, filename);
+
+    munmap((void*) text, status.st_size);
+    close(fd);
+    if(error)
+      return -1;
+
+    reinit_processor();
+    flush_cache();
+    return 0;
+  }
+
+  /* Load instructions into memory, a page at a time, swapping the byte
+     order of every word on the way */
+  entry_point = PROGRAM_START;
+  words = status.st_size / sizeof(word);
+  for(i = 0; i < words; i += chunk)
+  {
+    if(!(memory = (word*) mapDRAM(PROGRAM_START + i * sizeof(word), &bytes)))
+      break;
+    chunk = bytes / sizeof(word) < words - i ? bytes / sizeof(word) : words - i;
+    reverse_words(memory, text + i, chunk);
+  }
+
+  if(text != NULL)
+    munmap((void*) text, status.st_size);
+  close(fd);
+
   /* Insert sentinel instruction */
-  *((word*)inst) = 0xffffffff;
-  accessDRAM(PROGRAM_START + i, inst, WORD_SIZE, WRITE);
+  if(i < words || !(memory = (word*) mapDRAM(PROGRAM_START + i * sizeof(word), &bytes)))
+  {
+    if(LOG_ENABLED(LOG_SUMMARY))
+      append_log("Program does not fit in memory\n");
+    return -1;
+  }
+  *memory = sentinel;
 
-  fclose(dumpfile);
-  free(inst);
+  if(LOG_ENABLED(LOG_SUMMARY))
+  {
+    sprintf(buffer, "[%s] loaded, %u instructions\n", filename, words);
+    append_log(buffer);
+  }
 
   /* Initialize processor */
   reinit_processor();
@@ -79,6 +359,224 @@ int load_dumpfile(const char* filename)
   return 0;
 }
 
+/* Checkpoint file
+   ===============
+   A CheckpointHeader, the virtual address of every saved page, the cache
+   blocks if saved (each a CheckpointBlock followed by block_size bytes of
+   data), then the pages themselves, starting at a multiple of the page size
+   so that they can be mapped straight from the file. Everything is in host
+   byte order, for the machine that wrote it.
+*/
+#define CHECKPOINT_MAGIC "TIPSCKP1"
+
+typedef struct {
+  char magic[8];
+  word page_bytes;
+  word page_levels;
+  word pages;
+  word with_cache;
+  address pc;
+  address entry;
+  word registers[32];
+  word hilo[2];
+  word set_count;
+  word assoc;
+  word block_size;
+  word policy;
+  word sync_policy;
+} CheckpointHeader;
+
+typedef struct {
+  word valid;
+  word dirty;
+  word tag;
+  word lru;
+  word access_count;
+} CheckpointBlock;
+
+/*
+  Saves the processor state and every mapped page of memory to filename,
+  plus the cache contents and replacement state if with_cache is set. Only
+  a single core with its own cache is saved.
+
+  returns 0 if successful, -1 if the file could not be written, -2 if
+  several cores or cache partitioning are set up
+ */
+int save_checkpoint(const char* filename, int with_cache)
+{
+  CheckpointHeader header;
+  CheckpointBlock block;
+  FILE* file;
+  address addr;
+  byte* data;
+  cacheBlock* source;
+  unsigned int frame;
+  unsigned int set;
+  unsigned int way;
+  int error;
+
+  if(multicore.cores > 1 || partitions.mode != PARTITION_OFF)
+    return -2;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  get_page_table_info(&header.page_bytes, &header.page_levels, &header.pages);
+  header.with_cache = with_cache;
+  header.pc = PC;
+  header.entry = entry_point;
+  memcpy(header.registers, registers, sizeof(header.registers));
+  memcpy(header.hilo, hilo, sizeof(header.hilo));
+  header.set_count = set_count;
+  header.assoc = assoc;
+  header.block_size = block_size;
+  header.policy = policy;
+  header.sync_policy = memory_sync_policy;
+
+  if(!(file = fopen(filename, "wb")))
+    return -1;
+
+  fwrite(&header, sizeof(header), 1, file);
+  for(frame = 0; get_frame(frame, &addr); frame++)
+    fwrite(&addr, sizeof(addr), 1, file);
+
+  for(set = 0; with_cache && set < set_count; set++)
+  {
+    for(way = 0; way < assoc; way++)
+    {
+      source = &cache[set].block[way];
+      block.valid = source->valid;
+      block.dirty = source->dirty;
+      block.tag = source->tag;
+      block.lru = source->lru.value;
+      block.access_count = source->accessCount;
+      fwrite(&block, sizeof(block), 1, file);
+      fwrite(source->data, block_size, 1, file);
+    }
+  }
+
+  /* Align the pages so that they can be mapped */
+  fseek(file, (header.page_bytes - ftell(file) % header.page_bytes) % header.page_bytes, SEEK_CUR);
+  for(frame = 0; (data = get_frame(frame, &addr)); frame++)
+    fwrite(data, header.page_bytes, 1, file);
+
+  error = ferror(file);
+  if(fclose(file) != 0 || error)
+    return -1;
+  return 0;
+}
+
+/*
+  Restores a checkpoint written by save_checkpoint(), replacing the page
+  table, memory and processor state, and the cache configuration and
+  contents if they were saved; otherwise the cache is flushed. Statistics
+  start over. TLB, DRAM timing, branch predictor and pipeline state start
+  cold. Checkpoints hold a single core, so several cores or partitioning
+  have to be turned off first.
+
+  returns 0 if successful, -1 if the file is not a usable checkpoint or
+  its pages do not fit in memory, -2 if several cores or cache
+  partitioning are set up
+ */
+int load_checkpoint(const char* filename)
+{
+  const CheckpointHeader* header;
+  const CheckpointBlock* block;
+  const address* pages;
+  const byte* image;
+  const byte* cursor;
+  struct stat status;
+  cacheBlock* target;
+  byte* memory;
+  unsigned int bytes;
+  unsigned int blocks;
+  unsigned int i;
+  unsigned long long offset;
+  int fd;
+
+  if(multicore.cores > 1 || partitions.mode != PARTITION_OFF)
+    return -2;
+  if((fd = open(filename, O_RDONLY)) == -1)
+    return -1;
+  if(fstat(fd, &status) == -1 || status.st_size < sizeof(CheckpointHeader) ||
+     (image = (const byte*) mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+  {
+    close(fd);
+    return -1;
+  }
+
+  /* Check that every section fits in the file */
+  header = (const CheckpointHeader*) image;
+  blocks = header->with_cache ? header->set_count * header->assoc : 0;
+  offset = sizeof(CheckpointHeader) + (unsigned long long)header->pages * sizeof(address);
+  offset += (unsigned long long)blocks * (sizeof(CheckpointBlock) + header->block_size);
+  if(header->page_bytes != 0)
+    offset += (header->page_bytes - offset % header->page_bytes) % header->page_bytes;
+
+  if(memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+     header->set_count > MAX_SETS || header->assoc > MAX_ASSOC || header->block_size > MAX_BLOCK_SIZE ||
+     offset + (unsigned long long)header->pages * header->page_bytes > status.st_size ||
+     configure_page_table(header->page_bytes, header->page_levels) != 0)
+  {
+    munmap((void*) image, status.st_size);
+    close(fd);
+    return -1;
+  }
+
+  /* Memory */
+  pages = (const address*) (image + sizeof(CheckpointHeader));
+  for(i = 0; i < header->pages; i++)
+  {
+    if(!(memory = mapDRAM(pages[i], &bytes)))
+    {
+      if(LOG_ENABLED(LOG_SUMMARY))
+        append_log("Checkpoint does not fit in memory\n");
+      munmap((void*) image, status.st_size);
+      close(fd);
+      return -1;
+    }
+    memcpy(memory, image + offset + (unsigned long long)i * header->page_bytes, header->page_bytes);
+  }
+
+  /* Processor */
+  PC = header->pc;
+  entry_point = header->entry;
+  memcpy(registers, header->registers, sizeof(registers));
+  memcpy(hilo, header->hilo, sizeof(hilo));
+
+  /* Cache */
+  if(header->with_cache)
+  {
+    set_count = header->set_count;
+    assoc = header->assoc;
+    block_size = header->block_size;
+    policy = header->policy;
+    memory_sync_policy = header->sync_policy;
+  }
+  flush_cache();
+
+  cursor = (const byte*) (pages + header->pages);
+  for(i = 0; i < blocks; i++)
+  {
+    block = (const CheckpointBlock*) cursor;
+    target = &cache[i / assoc].block[i % assoc];
+    target->valid = block->valid;
+    target->dirty = block->dirty;
+    target->tag = block->tag;
+    target->lru.value = block->lru;
+    target->accessCount = block->access_count;
+    memcpy(target->data, cursor + sizeof(CheckpointBlock), block_size);
+    cursor += sizeof(CheckpointBlock) + block_size;
+  }
+
+  munmap((void*) image, status.st_size);
+  close(fd);
+
+  reset_cache_stats();
+  flush_decoded();
+  refresh_register_display();
+  return 0;
+}
+
 void reverse_endianness(instruction* word)
 {
   int w = 0, i = 0;
@@ -105,7 +603,7 @@ int main(int argc, char** argv)
   init_memory();
 
   /* Check for flags */
-  if(argc >= 2 && (strcmp(argv[1], "-nogui") == 0))
+  if(argc >= 2 && (strcmp(argv[1], "-nogui") == 0 || strcmp(argv[1], "-batch") == 0))
     gui_active = 0;
 
   /* Build GUI */
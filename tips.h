@@ -6,6 +6,10 @@
 #define IS_GUI_ACTIVE() (gui_active == 1)
 
 typedef enum {INDEX, ASSOC} CacheView;
+
+/* Log levels, each one also printing everything the levels before it do */
+typedef enum {LOG_OFF, LOG_SUMMARY, LOG_INSTRUCTIONS, LOG_DRAM} LogLevel;
+#define LOG_ENABLED(level) (log_level >= (level))
 typedef unsigned char byte;
 typedef unsigned int word;
 typedef unsigned int address;
@@ -13,8 +17,12 @@ typedef unsigned int instruction;
 
 /* Define Memory Constants */
 #define PHYSICAL_PAGE_SIZE 16384
-#define PHYSICAL_PAGE_COUNT 4
-#define PAGE_TABLE_SIZE 4
+#define MAX_PAGE_SIZE 1048576
+#define MAX_PAGE_LEVELS 4
+#define MAX_TLB_ENTRIES 1024
+#define MAX_DRAM_CHANNELS 8
+#define MAX_DRAM_BANKS 32
+#define MAX_DRAM_QUEUE 64
 
 /* Define Address Space Constants */
 #define PROGRAM_START 0x00400000
@@ -23,13 +31,15 @@ typedef unsigned int instruction;
 #define STACK_START 0x7fffeffc
 
 /* Define Cache Constants */
-#define MAX_BLOCK_SIZE 32
+#define MAX_BLOCK_SIZE 256
 #define MAX_SETS 16
 #define MAX_ASSOC 5
 
 /* Define Execution Constants */
 #define MIN_SPEED 10
 #define MAX_SPEED 2000
+#define MAX_CORES 64                 /* cores fit a 64-bit sharer vector */
+#define CORE_STACK_BYTES 0x100000    /* stack space between two cores */
 
 /* Variables that will have to be externed */
 extern CacheView view;
@@ -38,6 +48,7 @@ extern unsigned int registers[32];
 extern unsigned int hilo[2];
 extern address PC;
 extern char* program_name;
+extern LogLevel log_level;
 
 
 /*****************************************************************************
@@ -55,6 +66,7 @@ typedef enum {WRITE_BACK, WRITE_THROUGH} MemorySyncPolicy;
 typedef enum {READ, WRITE} WriteEnable;
 typedef enum {BYTE_SIZE = 0, HALF_WORD_SIZE, WORD_SIZE, DOUBLEWORD_SIZE, QUADWORD_SIZE, OCTWORD_SIZE} TransferUnit;
 typedef enum {HIT, MISS} CacheAction;
+typedef enum {FETCH, DATA} AccessType;
 
 /*****************************************************************************
   Define cache variables and memory structure and functions 
@@ -69,6 +81,8 @@ extern MemorySyncPolicy memory_sync_policy;  /* Memory sync policy        */
 /* Define cache block
    ==================
    valid - assign INVALID if block invalid; assign VALID if block valid
+   shared - another core's cache may hold the block as well; with dirty
+            and valid this gives its MESI state
    tag - container for the tag bits; unsigned to allow ignoring sign ext issue
    data - the data contained in a block
    lru.data - pointer to lru information
@@ -77,6 +91,7 @@ extern MemorySyncPolicy memory_sync_policy;  /* Memory sync policy        */
 typedef struct {
   enum {INVALID, VALID} valid;   
   enum {VIRGIN, DIRTY} dirty;
+  int shared;
   unsigned int tag;
   byte data[MAX_BLOCK_SIZE];
   union { 
@@ -94,8 +109,379 @@ typedef struct {
   cacheBlock block[MAX_ASSOC];
 } cacheSet;
 
-/* Define actual cache structure that will be manipulated by accessMemory() */
-extern cacheSet cache[MAX_SETS];
+/* Define actual cache structure that will be manipulated by accessMemory(),
+   the private cache of the running core among core_caches */
+extern cacheSet* cache;
+extern cacheSet core_caches[MAX_CORES][MAX_SETS];
+
+/* Counters for the accesses accessMemory() simulates in detail */
+typedef struct {
+  unsigned long long accesses;
+  unsigned long long reads;
+  unsigned long long writes;
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long writebacks;
+} CacheStats;
+
+extern CacheStats cache_stats;
+
+/* Per-set counters, to find the sets where conflict misses concentrate */
+typedef struct {
+  unsigned long long hits;
+  unsigned long long misses;
+  unsigned long long evictions;
+  unsigned long long dirty_evictions;
+} SetCounters;
+
+extern SetCounters set_stats[MAX_SETS];
+
+/* Number of times a block with tag evicted a block with victim in set */
+typedef struct {
+  unsigned int set;
+  unsigned int tag;
+  unsigned int victim;
+  unsigned long long count;
+} EvictionPair;
+
+/* Define sampler state
+   ====================
+   period, warmup, window - accesses per sampling period, detailed accesses
+                            before each measurement window and measured
+                            accesses at the end of each period
+   position - accesses seen so far in the current period
+   warmed, detailed - accesses handled by functional warming / in detail
+   window_accesses, window_misses - counters of the open measurement window
+   units, sum, sum_squares - closed windows and the sums of their miss rates
+*/
+typedef struct {
+  int enabled;
+  int measuring;
+  unsigned int period;
+  unsigned int warmup;
+  unsigned int window;
+  unsigned int position;
+  unsigned long long warmed;
+  unsigned long long detailed;
+  unsigned int window_accesses;
+  unsigned int window_misses;
+  unsigned long long units;
+  double sum;
+  double sum_squares;
+} SamplingState;
+
+extern SamplingState sampling;
+
+/* Define set sampler state
+   ========================
+   ratio - only one in ratio sets, picked by a hash of the index, is
+           simulated
+   check - 1 if every set is still simulated, so that the estimate from
+           the sampled sets can be compared with the full cache
+   accesses - every access seen, sampled or not; the sampled sets keep
+              their own counters in set_stats
+*/
+typedef struct {
+  unsigned int ratio;
+  int check;
+  unsigned long long accesses;
+} SetSamplingState;
+
+extern SetSamplingState set_sampling;
+
+/* How accessMemory() treats accesses: DETAILED simulates and counts them,
+   WARMING only updates the cache's tags, data and replacement state and
+   FUNCTIONAL bypasses every model, straight to backing memory */
+typedef enum {DETAILED, WARMING, FUNCTIONAL} SimulationMode;
+
+extern SimulationMode simulation_mode;
+
+/* Define reuse distance profile
+   ============================
+   block_bytes - granularity at which reuse is measured
+   accesses, cold - accesses, and first touches of a block, per AccessType
+   stack_histogram - unique blocks touched between two uses of a block
+   time_histogram - accesses between two uses of a block
+   Histogram bucket 0 counts distance 0, bucket k counts [2^(k-1), 2^k)
+*/
+#define REUSE_BUCKETS 33
+
+typedef struct {
+  int enabled;
+  unsigned int block_bytes;
+  unsigned long long accesses[2];
+  unsigned long long cold[2];
+  unsigned long long stack_histogram[2][REUSE_BUCKETS];
+  unsigned long long time_histogram[2][REUSE_BUCKETS];
+} ReuseProfile;
+
+extern ReuseProfile reuse_profile;
+
+/* Define sharing detector
+   =======================
+   block_bytes - granularity at which sharing is detected
+   blocks - blocks the data accesses have touched
+   true_invalidations - copies a write took from cores that had used the
+                        written word since getting their copy
+   false_invalidations - copies a write took from cores that had only used
+                         other words of the block
+*/
+#define MAX_SHARING_PCS 4
+#define MAX_SHARING_BLOCK 4096
+
+typedef struct {
+  int enabled;
+  unsigned int block_bytes;
+  unsigned int blocks;
+  unsigned long long true_invalidations;
+  unsigned long long false_invalidations;
+} SharingProfile;
+
+extern SharingProfile sharing_profile;
+
+/* Sharing seen on one block: the cores that wrote it, how many of its words
+   more than one core / a single core wrote, the invalidations its writes
+   caused and the first MAX_SHARING_PCS stores that caused them */
+typedef struct {
+  address addr;
+  unsigned long long writers;
+  unsigned int shared_words;
+  unsigned int private_words;
+  unsigned long long true_invalidations;
+  unsigned long long false_invalidations;
+  address pcs[MAX_SHARING_PCS];
+  unsigned long long pc_invalidations[MAX_SHARING_PCS];
+} SharedBlock;
+
+/* Define trace event
+   ==================
+   Fixed-size binary record pushed into the trace ring buffer instead of
+   formatting text; decoded by format_trace_event() only when asked for.
+   kind - what happened; flag - READ or WRITE; action - HIT or MISS
+   size - bytes moved by a DRAM transfer
+   set, way - cache location of a cache access
+   pc - instruction being executed; addr - memory address involved
+   inst - instruction word of an EVENT_INST record
+*/
+typedef enum {EVENT_INST, EVENT_CACHE, EVENT_DRAM} EventKind;
+
+typedef struct {
+  byte kind;
+  byte flag;
+  byte action;
+  byte way;
+  unsigned short set;
+  unsigned short size;
+  address pc;
+  address addr;
+  word inst;
+} TraceEvent;
+
+extern int trace_active;
+
+/* Define TLB model
+   ================
+   entries, assoc, policy - geometry and replacement of the TLB; 0 entries
+                            means no TLB is modeled
+   walk_latency - cycles per page table level charged on a miss
+   hits, misses - lookups per AccessType
+   walk_cycles - total cycles spent walking the page table
+*/
+typedef struct {
+  unsigned int entries;
+  unsigned int assoc;
+  ReplacementPolicy policy;
+  unsigned int walk_latency;
+  unsigned long long hits[2];
+  unsigned long long misses[2];
+  unsigned long long walk_cycles;
+} TlbStats;
+
+extern TlbStats tlb_stats;
+
+/* Define DRAM timing model
+   ========================
+   channels, banks, row_bytes - organization; consecutive rows are spread
+                                over channels first, then banks
+   t_rcd, t_cas, t_rp - activate, column access and precharge times
+   closed_page - precharge after every access instead of leaving the row open
+   queue_depth - requests each channel can hold for the scheduler
+   requests, reads - requests serviced
+   row_hits, row_empty, row_conflicts - state of the bank each one found
+   latency, read_latency - cycles from arrival to the end of the transfer
+*/
+typedef struct {
+  int enabled;
+  unsigned int channels;
+  unsigned int banks;
+  unsigned int row_bytes;
+  unsigned int t_rcd;
+  unsigned int t_cas;
+  unsigned int t_rp;
+  int closed_page;
+  unsigned int queue_depth;
+  unsigned long long requests;
+  unsigned long long reads;
+  unsigned long long row_hits;
+  unsigned long long row_empty;
+  unsigned long long row_conflicts;
+  unsigned long long latency;
+  unsigned long long read_latency;
+} DramStats;
+
+extern DramStats dram_stats;
+
+/* Define pipeline timing model
+   ============================
+   An in-order IF/ID/EX/MEM/WB pipeline with full forwarding, branches
+   resolved in EX and predicted not taken, and jumps resolved in ID.
+   hit_latency - cycles of an access that hits, 1 stalls nothing
+   miss_penalty - cycles added by every miss, writeback, or access made
+                  with no cache; page walks add their own cycles
+   branch_penalty - cycles lost to a taken branch or a register jump
+   instructions, cycles - timed so far, cycles including the pipeline fill
+   load_use, branch, fetch, data - stall cycles by cause
+*/
+typedef struct {
+  int enabled;
+  unsigned int hit_latency;
+  unsigned int miss_penalty;
+  unsigned int branch_penalty;
+  unsigned long long instructions;
+  unsigned long long cycles;
+  unsigned long long load_use;
+  unsigned long long branch;
+  unsigned long long fetch;
+  unsigned long long data;
+} PipelineStats;
+
+extern PipelineStats pipeline;
+
+/* Define branch prediction unit
+   =============================
+   kind - direction predictor for beq and bne: a table of 2-bit counters
+          indexed by PC (bimodal) or by PC xor global history (gshare)
+   entries - counters in the table, gshare keeps log2(entries) history bits
+   btb_entries - direct-mapped targets of taken branches and jumps
+   wrong_path - instructions fetched into the I-cache down a mispredicted
+                path before it is squashed, 0 for none
+   branches, mispredicted - conditional branches and wrong directions
+   redirects, btb_misses - taken branches and jumps, and those whose target
+                           the BTB did not supply
+   wrong_path_fetches - fetches made down mispredicted paths, left out of
+                        the cache, coherence, sampling, profiling and TLB
+                        counters; their fills still reach the DRAM model
+*/
+#define MAX_PREDICTOR_ENTRIES 65536
+#define MAX_BTB_ENTRIES 4096
+
+typedef enum {BIMODAL, GSHARE} PredictorKind;
+
+typedef struct {
+  int enabled;
+  PredictorKind kind;
+  unsigned int entries;
+  unsigned int btb_entries;
+  unsigned int wrong_path;
+  unsigned long long branches;
+  unsigned long long mispredicted;
+  unsigned long long redirects;
+  unsigned long long btb_misses;
+  unsigned long long wrong_path_fetches;
+} PredictorStats;
+
+extern PredictorStats predictor;
+
+/* Define multi-core model
+   =======================
+   cores - cores sharing memory, each with its own registers and private
+           cache kept coherent by snooping MESI, unless partitioning has
+           them share one; the running one owns PC, registers[], hilo[]
+           and cache
+   quantum - instructions each core runs before the next one takes over
+   current - the running core
+   halted - cores that have reached the sentinel
+   instructions - executed by each core
+   invalidations - copies removed from other caches by a write
+   interventions - modified copies written back to serve another core's miss
+   upgrades - writes to a block held in the shared state
+   hits, misses - detailed cache accesses of each core
+*/
+typedef struct {
+  unsigned int cores;
+  unsigned int quantum;
+  unsigned int current;
+  int halted[MAX_CORES];
+  unsigned long long instructions[MAX_CORES];
+  unsigned long long invalidations;
+  unsigned long long interventions;
+  unsigned long long upgrades;
+  unsigned long long hits[MAX_CORES];
+  unsigned long long misses[MAX_CORES];
+} MulticoreState;
+
+extern MulticoreState multicore;
+
+/* Define cache partitioning
+   =========================
+   The tenants are the cores, which share core 0's cache instead of keeping
+   private ones while partitioning is on.
+   mode - PARTITION_STATIC keeps the masks it was given, PARTITION_UCP
+          resizes contiguous partitions from shadow tag utility monitors
+   masks - ways each tenant may fill on a miss; it still hits in any way
+   interval - accesses between two UCP repartitions
+   repartitions - UCP decisions that moved a way between tenants
+   utility - per tenant, hits its shadow tags saw at each LRU stack
+             position, halved at every repartition
+*/
+typedef enum {PARTITION_OFF, PARTITION_STATIC, PARTITION_UCP} PartitionMode;
+
+typedef struct {
+  PartitionMode mode;
+  unsigned int masks[MAX_CORES];
+  unsigned int interval;
+  unsigned long long repartitions;
+  unsigned long long utility[MAX_CORES][MAX_ASSOC];
+} PartitionState;
+
+extern PartitionState partitions;
+
+/* Define coherence directory
+   ==========================
+   enabled - misses and upgrades go to a directory that names the caches
+             holding each block instead of being snooped by every cache
+   pointers - sharers an entry can name, 0 for a full bit vector of every
+              core; once they overflow, invalidations are broadcast
+   entries, peak_entries - blocks some cache holds, now and at most
+   requests - misses and upgrades the directory handled
+   three_hop - requests forwarded to a cache holding the only copy
+   invalidating - requests that invalidated other copies
+   invalidations_sent - invalidation messages, broadcasts included
+   max_fanout - most invalidations sent for one request
+   broadcasts - requests that broadcast after the pointers overflowed
+*/
+typedef struct {
+  int enabled;
+  unsigned int pointers;
+  unsigned int entries;
+  unsigned int peak_entries;
+  unsigned long long requests;
+  unsigned long long three_hop;
+  unsigned long long invalidating;
+  unsigned long long invalidations_sent;
+  unsigned int max_fanout;
+  unsigned long long broadcasts;
+} DirectoryStats;
+
+extern DirectoryStats directory;
+
+/* Counters of the loads and stores issued by one instruction */
+typedef struct {
+  address pc;
+  unsigned long long accesses;
+  unsigned long long misses;
+  unsigned long long writebacks;
+} PcCounters;
 
 /*
   This function should be called when you want to interact with physical memory
@@ -111,6 +497,23 @@ extern cacheSet cache[MAX_SETS];
  */
 int accessDRAM(address addr, byte* data, TransferUnit mode, WriteEnable flag);
 
+/*
+  Moves a burst of bytes, a power of two up to MAX_BLOCK_SIZE, in one call.
+  The burst must not cross a page, which holds for any aligned line.
+
+  returns 0 if successful, non-zero if there was a problem.
+ */
+int burstDRAM(address addr, byte* data, unsigned int bytes, WriteEnable flag);
+
+/*
+  Moves lines bursts of bytes each, line i between addrs[i] and data[i],
+  as one batch whose requests are queued together, e.g. to drain the dirty
+  blocks of a cache.
+
+  returns the number of lines that could not be moved.
+ */
+int burstDRAMLines(const address* addrs, byte* const* data, unsigned int lines, unsigned int bytes, WriteEnable flag);
+
 
 /*
   This function is the function you will be implementing. Its purpose
@@ -123,6 +526,14 @@ int accessDRAM(address addr, byte* data, TransferUnit mode, WriteEnable flag);
 */
 void accessMemory(address addr, word* data, WriteEnable flag);
 
+/*
+  Reads the word at addr as the CPU would see it, from the cache if it holds
+  it, else from memory, without touching any statistics or state.
+
+  returns 0 if successful, -1 if addr cannot be mapped
+*/
+int peekMemory(address addr, word* data);
+
 /*
   These are the GUI functions you can call to visualize changes in the cache
  */
@@ -172,16 +583,53 @@ void highlight_offset(unsigned int set_num, unsigned int assoc_num, unsigned int
 
 /* Defined in tips.c */
 int load_dumpfile(const char* filename);
+int save_checkpoint(const char* filename, int with_cache);
+int load_checkpoint(const char* filename);
 void reverse_endianness(instruction* word);
 
 /* Defined in memory.c */
 void init_memory(void);
 void flush_cache(void);
+int configure_page_table(unsigned int page_bytes, unsigned int levels);
+void get_page_table_info(unsigned int* page_bytes, unsigned int* levels, unsigned int* frames_used);
+int configure_tlb(unsigned int entries, unsigned int assoc, ReplacementPolicy policy, unsigned int walk_latency);
+void access_tlb(address addr);
+void reset_tlb_stats(void);
+byte* mapDRAM(address addr, unsigned int* bytes);
+byte* get_frame(unsigned int frame, address* addr);
+int configure_dram(unsigned int channels, unsigned int banks, unsigned int row_bytes, unsigned int t_rcd, unsigned int t_cas, unsigned int t_rp, int closed_page, unsigned int queue_depth);
+void tick_dram(unsigned int cycles);
+unsigned int dram_pending(void);
+void reset_dram_stats(void);
 
 /* Defined in cpu.c */
+extern AccessType access_type;   /* kind of the access in progress  */
+extern address access_pc;        /* instruction that caused it      */
+extern int wrong_path_access;    /* fetched down a squashed path    */
+extern address entry_point;      /* where the loaded program starts */
+extern unsigned long long instruction_count;  /* executed so far */
+extern int batch_fetches;        /* run_processor() may batch fetches */
 void reinit_processor(void);
+unsigned long long run_processor(unsigned long long count);
+unsigned long long run_until(address pc, unsigned long long count);
+int configure_pipeline(unsigned int hit_latency, unsigned int miss_penalty, unsigned int branch_penalty);
+void reset_pipeline_stats(void);
+int configure_predictor(PredictorKind kind, unsigned int entries, unsigned int btb_entries, unsigned int wrong_path);
+void reset_predictor_stats(void);
+int configure_cores(unsigned int cores, unsigned int quantum);
+void reset_multicore_stats(void);
+void flush_decoded(void);
+void invalidate_decoded(address addr);
+void format_inst(char* buffer, word inst, address pc);
 void step_processor(void);
 
+/* Defined in util.c */
+int configure_trace(unsigned int capacity);
+void trace_event(EventKind kind, address addr, WriteEnable flag, unsigned int size, CacheAction action, unsigned int set, unsigned int way, word inst);
+unsigned long long trace_available(void);
+unsigned long long trace_dropped(void);
+void format_trace_event(char* buffer, unsigned long long index);
+
 /* Defined in gui.c */
 int build_gui(int argc, char** argv);
 void refresh_register_display();
@@ -198,3 +646,18 @@ void init_lru(int set_number, int assoc_value);
 char* lfu_to_string(int set_number, int assoc_value);
 char* lru_to_string(int set_number, int assoc_value);
 void validate_cache_parameters(int set_number, int assoc_value, int block_size_value);
+void reset_cache_stats(void);
+int configure_sampling(unsigned int period, unsigned int warmup, unsigned int window);
+int configure_set_sampling(unsigned int ratio, int check);
+int is_sampled_set(unsigned int index);
+void drain_cache(void);
+int configure_directory(int enabled, unsigned int pointers);
+void clear_directory(void);
+int configure_partitions(PartitionMode mode, const unsigned int* masks, unsigned int interval);
+void set_simulation_mode(SimulationMode mode);
+int configure_reuse_profile(unsigned int block_bytes);
+int get_hot_pcs(PcCounters* hot, int count);
+int count_eviction_pairs(void);
+int get_eviction_pairs(EvictionPair* pairs, int count);
+int configure_sharing_profile(unsigned int block_bytes);
+int get_shared_blocks(SharedBlock* blocks, int count);
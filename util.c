@@ -1,4 +1,11 @@
 #include "tips.h"
+#include <stdint.h>
+
+/* Trace ring buffer, see configure_trace() */
+int trace_active;
+static TraceEvent* trace_buffer;
+static unsigned int trace_capacity;          /* power of two */
+static unsigned long long trace_written;     /* events pushed so far */
 
 /* finds the highest 1 bit, and returns its position, else 0xffffffff */
 unsigned int uint_log2(unsigned int w) 
@@ -17,7 +24,139 @@ unsigned int uint_log2(unsigned int w)
   return z;
 }
 
+/* returns the square root of x using Newton's method, 0 for x <= 0 */
+double square_root(double x)
+{
+  double root = x;
+  int i;
+
+  if(x <= 0)
+    return 0;
+
+  for(i = 0; i < 64; i++)
+    root = (root + x / root) / 2;
+
+  return root;
+}
+
+/* returns the number of 1 bits in bits */
+unsigned int count_bits(unsigned long long bits)
+{
+  unsigned int count = 0;
+
+  for(; bits != 0; bits &= bits - 1)
+    count++;
+  return count;
+}
+
+/* copies count words from src to dst, reversing the bytes of each; when
+   both are 8-byte aligned, two words are swapped at a time in a 64-bit
+   register */
+void reverse_words(unsigned int* dst, const unsigned int* src, unsigned int count)
+{
+  unsigned long long x;
+  unsigned int w;
+  unsigned int i = 0;
+
+  if((((uintptr_t)dst | (uintptr_t)src) & 7) == 0)
+  {
+    for(; i + 1 < count; i += 2)
+    {
+      x = *(const unsigned long long*)(src + i);
+      x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+      x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+      *(unsigned long long*)(dst + i) = x;
+    }
+  }
+
+  for(; i < count; i++)
+  {
+    w = src[i];
+    dst[i] = (w >> 24) | ((w >> 8) & 0xff00) | ((w << 8) & 0xff0000) | (w << 24);
+  }
+}
+
 /* return random int from 0..x-1 */
 int randomint( int x ) { 
   return rand()%x;
 }
+
+/*
+  Starts recording trace events into a ring buffer of capacity records,
+  rounded down to a power of two, discarding any earlier trace. Once full,
+  the oldest records are overwritten. A capacity of 0 stops tracing.
+
+  returns 0 if successful, -1 if the buffer could not be allocated
+ */
+int configure_trace(unsigned int capacity)
+{
+  free(trace_buffer);
+  trace_buffer = NULL;
+  trace_active = 0;
+  trace_capacity = 0;
+  trace_written = 0;
+
+  if(capacity == 0)
+    return 0;
+
+  capacity = 1 << uint_log2(capacity);
+  if(!(trace_buffer = (TraceEvent*) malloc(capacity * sizeof(TraceEvent))))
+    return -1;
+
+  trace_capacity = capacity;
+  trace_active = 1;
+  return 0;
+}
+
+/* Records one event; callers check trace_active first */
+void trace_event(EventKind kind, address addr, WriteEnable flag, unsigned int size, CacheAction action, unsigned int set, unsigned int way, word inst)
+{
+  TraceEvent* event = &trace_buffer[trace_written++ & (trace_capacity - 1)];
+
+  event->kind = kind;
+  event->flag = flag;
+  event->action = action;
+  event->size = size;
+  event->set = set;
+  event->way = way;
+  event->pc = access_pc;
+  event->addr = addr;
+  event->inst = inst;
+}
+
+/* returns the number of events still held in the buffer */
+unsigned long long trace_available(void)
+{
+  return trace_written < trace_capacity ? trace_written : trace_capacity;
+}
+
+/* returns the number of events overwritten before they could be decoded */
+unsigned long long trace_dropped(void)
+{
+  return trace_written - trace_available();
+}
+
+/* Decodes the index-th oldest event still in the buffer into buffer */
+void format_trace_event(char* buffer, unsigned long long index)
+{
+  TraceEvent* event = &trace_buffer[(trace_dropped() + index) & (trace_capacity - 1)];
+  int length;
+
+  switch(event->kind)
+  {
+  case EVENT_INST:
+    length = sprintf(buffer, "[0x%08X]: 0x%08X\t", event->pc, event->inst);
+    format_inst(buffer + length, event->inst, event->pc + sizeof(instruction));
+    break;
+  case EVENT_CACHE:
+    sprintf(buffer, "%s 0x%08X %s in set %u, block %u (pc 0x%08X)\n",
+	    event->flag == READ ? "Read" : "Write", event->addr,
+	    event->action == HIT ? "hit" : "missed", event->set, event->way, event->pc);
+    break;
+  case EVENT_DRAM:
+    sprintf(buffer, "%s %u bytes at 0x%08X\n", event->flag == READ ? "Accessing" : "Updating", event->size, event->addr);
+    break;
+  default:
+    sprintf(buffer, "Corrupt trace event\n");
+  }
+}
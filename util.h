@@ -3,3 +3,12 @@ unsigned int uint_log2(unsigned int w);
 
 /* return random int from 0..x-1 */
 int randomint( int x );
+
+/* copies count words from src to dst, reversing the bytes of each */
+void reverse_words(unsigned int* dst, const unsigned int* src, unsigned int count);
+
+/* returns the square root of x using Newton's method, 0 for x <= 0 */
+double square_root(double x);
+
+/* returns the number of 1 bits in bits */
+unsigned int count_bits(unsigned long long bits);